@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+
+//atlas_capture: a single GetImage, so the glyphs cost one round trip however they're used
+bool atlas_capture(
+	xcb_connection_t *connection, xcb_screen_t *screen, xcb_font_t font,
+	xcb_charinfo_t *metrics, int ascent, int descent, struct Atlas *atlas
+) {
+	int left = 0, right = 1;
+	for (int k = 0; k < 95; k++) {
+		if (left > metrics[k].left_side_bearing) left = metrics[k].left_side_bearing;
+		if (right < metrics[k].right_side_bearing) right = metrics[k].right_side_bearing;
+	}
+	int pitch = right - left, width = 95*pitch, height = ascent + descent;
+	
+	xcb_pixmap_t strip = xcb_generate_id(connection);
+	xcb_create_pixmap(connection, 8, strip, screen->root, width, height);
+	xcb_gcontext_t pen = xcb_generate_id(connection);
+	xcb_create_gc(
+		connection, pen, strip,
+		XCB_GC_FOREGROUND | XCB_GC_FONT | XCB_GC_GRAPHICS_EXPOSURES,
+		(uint32_t[]) {0, font, 0}
+	);
+	xcb_poly_fill_rectangle(connection, strip, pen, 1, (const xcb_rectangle_t[]) {{0, 0, width, height}});
+	xcb_change_gc(connection, pen, XCB_GC_FOREGROUND, (uint32_t[]) {0xff});
+	for (int k = 0; k < 95; k++) {
+		xcb_poly_text_8(connection, strip, pen, k*pitch - left, ascent, 3, (uint8_t[]) {1, 0, 0x20 + k});
+	}
+	xcb_get_image_reply_t *image = xcb_get_image_reply(connection, xcb_get_image(
+		connection, XCB_IMAGE_FORMAT_Z_PIXMAP, strip, 0, 0, width, height, ~0
+	), NULL);
+	xcb_free_gc(connection, pen);
+	xcb_free_pixmap(connection, strip);
+	if (!image) return false;
+	
+	int length = xcb_get_image_data_length(image);
+	atlas->pixels = malloc(length);
+	if (atlas->pixels) memcpy(atlas->pixels, xcb_get_image_data(image), length);
+	free(image);
+	atlas->stride = length / height;
+	atlas->height = height;
+	atlas->pitch = pitch;
+	atlas->left = left;
+	atlas->ascent = ascent;
+	return atlas->pixels != NULL;
+}
+
+void atlas_free(struct Atlas *atlas) {
+	free(atlas->pixels);
+	atlas->pixels = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+//the origin of character c is at ((c-0x20)*pitch - left, ascent)
+struct Atlas {
+	uint8_t *pixels;
+	int stride, height;
+	int pitch, left, ascent;
+};
+
+bool atlas_capture(
+	xcb_connection_t *, xcb_screen_t *, xcb_font_t,
+	xcb_charinfo_t *metrics, int ascent, int descent, struct Atlas *atlas
+);
+void atlas_free(struct Atlas *atlas);
+
+#endif
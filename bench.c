@@ -0,0 +1,176 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "document.h"
+#include "render.h"
+
+//bench: times layout and rendering without a display, at several window widths
+
+#define HEIGHT 1080
+#define REPEATS 200
+
+struct Test {
+	char *name;
+	void (*run)(struct View *view, int i);
+};
+
+typedef void (*generator_t)(FILE *file);
+
+void bench(char *name, doc_t *document);
+void report(char *name, int width, struct Test *test, double seconds, int count);
+doc_t *synthesize(generator_t generate);
+void generateCode(FILE *file);
+void generateLongLine(FILE *file);
+void generateBinary(FILE *file);
+
+void testOpen(struct View *view, int i);
+void testFrame(struct View *view, int i);
+void testJump(struct View *view, int i);
+void testScroll(struct View *view, int i);
+void testType(struct View *view, int i);
+void testClick(struct View *view, int i);
+
+int widths[] = {320, 800, 1920};
+
+struct Test tests[] = {
+	{"open", testOpen},
+	{"frame", testFrame},
+	{"jump", testJump},
+	{"scroll", testScroll},
+	{"type", testType},
+	{"click", testClick},
+	{NULL}
+};
+
+int main(int argc, char **argv) {
+	backend = nullBackend;
+	for (int c = 0x20; c < 0x7F; c++) advanceLookupTable[c-0x20] = 5 + c%4;
+	lineoffset = 10;
+	lineheight = 13;
+	fg = 1;
+	
+	printf("%-12s %6s %-8s %12s %12s %12s\n", "document", "width", "test", "us/op", "calls/op", "chars/op");
+	bench("code", synthesize(generateCode));
+	bench("longline", synthesize(generateLongLine));
+	bench("binary", synthesize(generateBinary));
+	for (int i = 1; i < argc; i++) {
+		char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+		bench(name, load(NULL, argv[i]));
+	}
+	return 0;
+}
+
+void bench(char *name, doc_t *document) {
+	if (!document) return;
+	struct View view = {0};
+	addView(document, &view);
+	for (int w = 0; w < (int) (sizeof(widths)/sizeof(int)); w++) {
+		for (struct Test *test = tests; test->name; test++) {
+			resizeCanvas(&view, 1, HEIGHT);
+			resizeCanvas(&view, widths[w], HEIGHT);
+			view.scroll = view.cursor = view.selection = 0;
+			view.scrollOffset = 0;
+			srand(1);
+			int count = test->run == testOpen ? 1 : REPEATS;
+			nullCalls = 0;
+			nullCharacters = 0;
+			double start = now();
+			for (int i = 0; i < count; i++) test->run(&view, i);
+			report(name, widths[w], test, now() - start, count);
+		}
+	}
+	forgetCanvas(&view);
+	removeView(&view);
+}
+
+void report(char *name, int width, struct Test *test, double seconds, int count) {
+	printf(
+		"%-12s %6d %-8s %12.1f %12.1f %12.1f\n", name, width, test->name,
+		seconds * 1e6 / count, (double) nullCalls / count, (double) nullCharacters / count
+	);
+}
+
+void testOpen(struct View *view, int i) {
+	(void) i;
+	draw(view, NULL);
+}
+
+void testFrame(struct View *view, int i) {
+	(void) i;
+	resizeCanvas(view, view->width, view->height);
+	draw(view, NULL);
+}
+
+void testJump(struct View *view, int i) {
+	(void) i;
+	view->scroll = startOfRow(view, (long) ((double) rand() / RAND_MAX * view->document->length));
+	draw(view, NULL);
+}
+
+void testScroll(struct View *view, int i) {
+	(void) i;
+	long row = nextRow(view, view->scroll);
+	if (row >= 0) view->scroll = row;
+	draw(view, NULL);
+}
+
+void testType(struct View *view, int i) {
+	doc_t *document = view->document;
+	if (i == 0) {
+		view->scroll = startOfRow(view, document->length/2);
+		view->cursor = view->selection = positionInRow(
+			view, nextRow(view, nextRow(view, view->scroll)), view->width/2
+		);
+		draw(view, NULL);
+	}
+	doInsertAction(document, view->cursor, 1, "x");
+	draw(view, NULL);
+}
+
+void testClick(struct View *view, int i) {
+	(void) i;
+	findPositionIn(view, rand() % view->width, rand() % view->height);
+}
+
+//synthesize: the mapping outlives the name
+doc_t *synthesize(generator_t generate) {
+	char path[] = "/tmp/texi-bench.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) return NULL;
+	FILE *file = fdopen(fd, "w");
+	if (!file) {
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	generate(file);
+	fclose(file);
+	doc_t *document = load(NULL, strdup(path));
+	unlink(path);
+	return document;
+}
+
+void generateCode(FILE *file) {
+	srand(2);
+	for (int line = 0; line < 200000; line++) {
+		for (int tabs = rand() % 5; tabs > 0; tabs--) fputc('\t', file);
+		for (int length = rand() % 100; length > 0; length--) {
+			fputc(rand() % 6 ? 'a' + rand() % 26 : ' ', file);
+		}
+		fputc('\n', file);
+	}
+}
+
+void generateLongLine(FILE *file) {
+	srand(3);
+	for (long i = 0; i < 8L<<20; i++) fputc(rand() % 8 ? 'a' + rand() % 26 : ' ', file);
+}
+
+void generateBinary(FILE *file) {
+	srand(4);
+	for (long i = 0; i < 1L<<20; i++) fputc(rand() % 256, file);
+}
@@ -5,26 +5,83 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <poll.h>
 
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 
-enum ClipboardAtom {CLIPBOARD, TARGETS, STRING, UTF8_STRING, UTF8_PLAINTEXT, ATOM_END};
-const char *atomNames[ATOM_END] = {"CLIPBOARD", "TARGETS", "STRING", "UTF8_STRING", "text/plain;charset=utf-8"};
+#include "clipboard.h"
+#include "render.h"
+#include "stats.h"
+
+//the timeout is in milliseconds, text longer than a chunk is sent incrementally
+#define CLIPBOARD_TIMEOUT 2000
+#define CLIPBOARD_CHUNK 262144
+#define OUTGOING 8
+
+enum ClipboardAtom {CLIPBOARD, TARGETS, STRING, UTF8_STRING, UTF8_PLAINTEXT, INCR, ATOM_END};
+const char *atomNames[ATOM_END] = {
+	"CLIPBOARD", "TARGETS", "STRING", "UTF8_STRING", "text/plain;charset=utf-8", "INCR"
+};
 xcb_atom_t atoms[ATOM_END];
 
 xcb_atom_t property;
 
 const enum ClipboardAtom selection = CLIPBOARD;
 
+//pieces of the document the text was copied from, kept is a copy made before that text goes away
+struct Source {
+	struct Piece *pieces;
+	int count;
+	long length;
+	int references;
+	char *kept;
+};
+
 struct {
 	xcb_connection_t *connection;
 	xcb_window_t window;
 	
-	char *source;
-	int length;
+	struct Source *source;
 } clipboard;
 
+//active is when the requestor last took a chunk, in seconds
+struct Outgoing {
+	struct Source *source;
+	xcb_window_t requestor;
+	xcb_atom_t property, target;
+	long offset, chunk;
+	long started;
+	double active;
+} outgoing[OUTGOING];
+
+long transfers = 0;
+
+struct {
+	xcb_generic_event_t **events;
+	int count, capacity;
+} deferred;
+
+struct Transfer {
+	char *data;
+	long length, capacity;
+	bool complete;
+};
+
+static xcb_generic_event_t *waitFor(uint8_t type);
+static void defer(xcb_generic_event_t *event);
+static xcb_get_property_reply_t *takeProperty();
+static bool receive(struct Transfer *transfer, const char *data, long length);
+static void startOutgoing(xcb_selection_request_event_t *event, long chunk);
+static void watchRequestor(xcb_window_t window);
+static void sendRange(
+	struct Source *source, long from, long length, xcb_window_t window, xcb_atom_t property, xcb_atom_t type
+);
+static void keep(struct Source *source);
+static void release(struct Source *source);
+
 xcb_atom_t getAtomReply(xcb_intern_atom_cookie_t cookie) {
 	xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(clipboard.connection, cookie, NULL);
 	xcb_atom_t atom = reply ? reply->atom : XCB_NONE;
@@ -49,57 +106,186 @@ void clipboard_init(xcb_connection_t *connection, xcb_window_t window, char *lab
 	}
 	
 	property = getAtomReply(propertyCookie);
+	
+	//incremental transfers are driven by changes to the property
+	xcb_get_window_attributes_reply_t *attributes = xcb_get_window_attributes_reply(
+		clipboard.connection, xcb_get_window_attributes(clipboard.connection, clipboard.window), NULL
+	);
+	if (attributes) {
+		xcb_change_window_attributes(
+			clipboard.connection, clipboard.window, XCB_CW_EVENT_MASK,
+			(uint32_t[]) {attributes->your_event_mask | XCB_EVENT_MASK_PROPERTY_CHANGE}
+		);
+		free(attributes);
+	}
 }
 
-//clipboard_get: reads the clipboard from its current owner, copying it to the provided buffer
-int clipboard_get(char *str, int length, int offset) {
+//clipboard_get: reads the clipboard from its current owner, following INCR, the caller frees the text
+char *clipboard_get(long *length) {
+	*length = 0;
+	xcb_get_selection_owner_reply_t *owner = xcb_get_selection_owner_reply(
+		clipboard.connection, xcb_get_selection_owner(clipboard.connection, atoms[selection]), NULL
+	);
+	STAT(roundTrips, 1);
+	xcb_window_t window = owner ? owner->owner : XCB_NONE;
+	free(owner);
+	if (window == XCB_NONE) return NULL;
+	if (window == clipboard.window) {
+		struct Source *source = clipboard.source;
+		struct Transfer transfer = {0};
+		for (int k = 0; source && k < source->count; k++) {
+			if (!receive(&transfer, source->pieces[k].data, source->pieces[k].length)) {
+				free(transfer.data);
+				return NULL;
+			}
+		}
+		*length = transfer.length;
+		return transfer.data ? transfer.data : malloc(1);
+	}
+	
+	xcb_delete_property(clipboard.connection, clipboard.window, property);
 	xcb_convert_selection(
-		clipboard.connection, clipboard.window, atoms[selection], 
-		XCB_ATOM_STRING, property,
-		XCB_CURRENT_TIME
+		clipboard.connection, clipboard.window, atoms[selection],
+		atoms[STRING], property, XCB_CURRENT_TIME
 	);
 	xcb_flush(clipboard.connection);
+	xcb_selection_notify_event_t *notify = (xcb_selection_notify_event_t *) waitFor(XCB_SELECTION_NOTIFY);
+	bool converted = notify && notify->property != XCB_NONE;
+	free(notify);
+	if (!converted) return NULL;
 	
-	free(xcb_wait_for_event(clipboard.connection));
-	
-	xcb_get_property_reply_t* reply = xcb_get_property_reply(
+	struct Transfer transfer = {0};
+	xcb_get_property_reply_t *reply = takeProperty();
+	if (reply && reply->type == atoms[INCR]) {
+		//the owner starts sending once the INCR property is deleted, ending with an empty value
+		free(reply);
+		for (;;) {
+			xcb_generic_event_t *event = waitFor(XCB_PROPERTY_NOTIFY);
+			if (!event) break;
+			free(event);
+			if (!(reply = takeProperty())) break;
+			int size = xcb_get_property_value_length(reply);
+			bool added = size > 0 && receive(&transfer, xcb_get_property_value(reply), size);
+			free(reply);
+			if (!added) {
+				transfer.complete = size == 0;
+				break;
+			}
+		}
+	} else if (reply) {
+		transfer.complete = receive(
+			&transfer, xcb_get_property_value(reply), xcb_get_property_value_length(reply)
+		);
+		free(reply);
+	}
+	if (!transfer.complete) {
+		free(transfer.data);
+		return NULL;
+	}
+	*length = transfer.length;
+	return transfer.data ? transfer.data : malloc(1);
+}
+
+xcb_generic_event_t *clipboard_nextEvent() {
+	if (deferred.count == 0) return xcb_poll_for_event(clipboard.connection);
+	xcb_generic_event_t *event = deferred.events[0];
+	memmove(deferred.events, deferred.events + 1, --deferred.count * sizeof(*deferred.events));
+	return event;
+}
+
+//clipboard_pending: events read off the connection while waiting for a reply wouldn't wake a poll on it
+bool clipboard_pending() {
+	if (deferred.count) return true;
+	xcb_generic_event_t *event = xcb_poll_for_queued_event(clipboard.connection);
+	if (event) defer(event);
+	return event != NULL;
+}
+
+static xcb_generic_event_t *waitFor(uint8_t type) {
+	for (;;) {
+		xcb_generic_event_t *event = xcb_poll_for_event(clipboard.connection);
+		if (!event) {
+			if (xcb_connection_has_error(clipboard.connection)) return NULL;
+			struct pollfd fd = {.fd = xcb_get_file_descriptor(clipboard.connection), .events = POLLIN};
+			if (poll(&fd, 1, CLIPBOARD_TIMEOUT) <= 0) return NULL;
+			continue;
+		}
+		uint8_t evtype = event->response_type & ~0x80;
+		if (evtype == type && type == XCB_SELECTION_NOTIFY) {
+			xcb_selection_notify_event_t *notify = (xcb_selection_notify_event_t *) event;
+			if (notify->requestor == clipboard.window && notify->selection == atoms[selection]) return event;
+		} else if (evtype == type && type == XCB_PROPERTY_NOTIFY) {
+			xcb_property_notify_event_t *notify = (xcb_property_notify_event_t *) event;
+			if (
+				notify->window == clipboard.window && notify->atom == property
+				&& notify->state == XCB_PROPERTY_NEW_VALUE
+			) return event;
+		}
+		defer(event);
+	}
+}
+
+static void defer(xcb_generic_event_t *event) {
+	if (deferred.count == deferred.capacity) {
+		int capacity = deferred.capacity ? deferred.capacity*2 : 16;
+		xcb_generic_event_t **events = realloc(deferred.events, capacity * sizeof(*events));
+		if (!events) {
+			free(event);
+			return;
+		}
+		deferred.events = events;
+		deferred.capacity = capacity;
+	}
+	deferred.events[deferred.count++] = event;
+}
+
+static xcb_get_property_reply_t *takeProperty() {
+	xcb_get_property_reply_t *reply = xcb_get_property_reply(
 		clipboard.connection,
 		xcb_get_property(
-			clipboard.connection, 0, clipboard.window,
-			property, atoms[STRING],
-			offset/4, length/4
+			clipboard.connection, 1, clipboard.window,
+			property, XCB_GET_PROPERTY_TYPE_ANY, 0, UINT32_MAX/4
 		),
 		NULL
 	);
-	
-	char *news = "";
-	int newl = 0;
-	if (reply) {
-		news = xcb_get_property_value(reply);
-		newl = xcb_get_property_value_length(reply);
-	}
-	if (newl == 0 && clipboard.source && clipboard.length > offset) {
-		news = clipboard.source+offset;
-		newl = clipboard.length-offset;
-	}
-	length = length > newl ? newl : length;
-	memcpy(str, news, length);
-	
-	if (reply) free(reply);
-	xcb_delete_property(clipboard.connection, clipboard.window, property);
-	return length;
+	STAT(roundTrips, 1);
+	return reply;
 }
 
-//clipboard_set: takes ownership of the clipboard and caches the given string, which will later be provided to those requesting data from the clipboard
-void clipboard_set(char *str, int length) {
-	if (clipboard.source) free(clipboard.source);
-	clipboard.source = malloc(length);
-	clipboard.length = length;
-	memcpy(clipboard.source, str, clipboard.length);
+static bool receive(struct Transfer *transfer, const char *data, long length) {
+	if (transfer->length + length > transfer->capacity) {
+		long capacity = transfer->capacity ? transfer->capacity : 65536;
+		while (capacity < transfer->length + length) capacity *= 2;
+		char *grown = realloc(transfer->data, capacity);
+		if (!grown) return false;
+		transfer->data = grown;
+		transfer->capacity = capacity;
+	}
+	memcpy(transfer->data + transfer->length, data, length);
+	transfer->length += length;
+	return true;
+}
+
+//clipboard_set: takes ownership of the clipboard to serve the text of the given pieces, which it takes
+void clipboard_set(struct Piece *pieces, int count, long length) {
+	struct Source *source = malloc(sizeof(struct Source));
+	if (!source) {
+		free(pieces);
+		return;
+	}
+	*source = (struct Source) {.pieces = pieces, .count = count, .length = length, .references = 1};
+	release(clipboard.source);
+	clipboard.source = source;
 	xcb_set_selection_owner(clipboard.connection, clipboard.window, atoms[selection], XCB_CURRENT_TIME);
 	xcb_flush(clipboard.connection);
 }
 
+//clipboard_keep: copies out the text being served, for when the document is about to be dropped
+void clipboard_keep() {
+	keep(clipboard.source);
+	for (int i = 0; i < OUTGOING; i++) keep(outgoing[i].source);
+}
+
 //clipboard_selectionRequest: handles a selection request event and passes the clipboard data to the requestor, sends the selection notify event afterwards 
 void clipboard_selectionRequest(xcb_selection_request_event_t *event) {
 	if (event->property == XCB_NONE) event->property = event->target;
@@ -112,15 +298,24 @@ void clipboard_selectionRequest(xcb_selection_request_event_t *event) {
 			event->requestor, event->property,
 			XCB_ATOM_ATOM, sizeof(xcb_atom_t) * 8, sizeof(targets) / sizeof(xcb_atom_t), targets
 		);
-	} else if (event->target == atoms[STRING] || event->target == atoms[UTF8_STRING] || event->target == atoms[UTF8_PLAINTEXT]) {
-		xcb_change_property(
-			clipboard.connection, XCB_PROP_MODE_REPLACE,
-			event->requestor, event->property,
-			event->target, 8, clipboard.length, clipboard.source
-		);
+	} else if (
+		clipboard.source && (
+			event->target == atoms[STRING] || event->target == atoms[UTF8_STRING]
+			|| event->target == atoms[UTF8_PLAINTEXT]
+		)
+	) {
+		long chunk = xcb_get_maximum_request_length(clipboard.connection) * 4 - 64;
+		if (chunk > CLIPBOARD_CHUNK) chunk = CLIPBOARD_CHUNK;
+		if (clipboard.source->length > chunk) {
+			startOutgoing(event, chunk);
+		} else {
+			sendRange(
+				clipboard.source, 0, clipboard.source->length,
+				event->requestor, event->property, event->target
+			);
+		}
 	} else {
-		xcb_flush(clipboard.connection);
-		return;
+		event->property = XCB_NONE;
 	}
 	
 	xcb_send_event(
@@ -137,3 +332,126 @@ void clipboard_selectionRequest(xcb_selection_request_event_t *event) {
 	
 	xcb_flush(clipboard.connection);
 }
+
+//clipboard_propertyNotify: sends the next piece of an incremental transfer once the requestor deleted the last
+void clipboard_propertyNotify(xcb_property_notify_event_t *event) {
+	if (event->state != XCB_PROPERTY_DELETE) return;
+	for (int i = 0; i < OUTGOING; i++) {
+		struct Outgoing *out = outgoing + i;
+		if (!out->source || out->requestor != event->window || out->property != event->atom) continue;
+		long length = out->source->length - out->offset;
+		if (length > out->chunk) length = out->chunk;
+		sendRange(out->source, out->offset, length, out->requestor, out->property, out->target);
+		out->offset += length;
+		out->active = now();
+		if (length == 0) {
+			release(out->source);
+			out->source = NULL;
+			watchRequestor(out->requestor);
+		}
+		xcb_flush(clipboard.connection);
+		return;
+	}
+}
+
+//clipboard_expire: a requestor that stopped taking chunks would keep the text it's sent held forever
+bool clipboard_expire() {
+	bool left = false, expired = false;
+	double time = now();
+	for (int i = 0; i < OUTGOING; i++) {
+		struct Outgoing *out = outgoing + i;
+		if (!out->source) continue;
+		if (time - out->active < CLIPBOARD_TIMEOUT / 1000.0) {
+			left = true;
+			continue;
+		}
+		release(out->source);
+		out->source = NULL;
+		watchRequestor(out->requestor);
+		expired = true;
+	}
+	if (expired) xcb_flush(clipboard.connection);
+	return left;
+}
+
+static void startOutgoing(xcb_selection_request_event_t *event, long chunk) {
+	struct Outgoing *out = outgoing;
+	for (int i = 0; i < OUTGOING; i++) {
+		bool same = outgoing[i].requestor == event->requestor && outgoing[i].property == event->property;
+		if (same || !outgoing[i].source) {
+			out = outgoing + i;
+			break;
+		}
+		if (outgoing[i].started < out->started) out = outgoing + i;
+	}
+	xcb_window_t replaced = out->source ? out->requestor : XCB_NONE;
+	release(out->source);
+	clipboard.source->references++;
+	*out = (struct Outgoing) {
+		.source = clipboard.source, .requestor = event->requestor,
+		.property = event->property, .target = event->target,
+		.chunk = chunk, .started = ++transfers, .active = now()
+	};
+	if (replaced != XCB_NONE && replaced != event->requestor) watchRequestor(replaced);
+	watchRequestor(event->requestor);
+	uint32_t size = clipboard.source->length > UINT32_MAX ? UINT32_MAX : clipboard.source->length;
+	xcb_change_property(
+		clipboard.connection, XCB_PROP_MODE_REPLACE,
+		event->requestor, event->property, atoms[INCR], 32, 1, &size
+	);
+}
+
+//watchRequestor: several transfers can be going on to different properties of the same window
+static void watchRequestor(xcb_window_t window) {
+	bool transferring = false;
+	for (int i = 0; i < OUTGOING; i++) transferring |= outgoing[i].source && outgoing[i].requestor == window;
+	xcb_change_window_attributes(
+		clipboard.connection, window, XCB_CW_EVENT_MASK,
+		(uint32_t[]) {transferring ? XCB_EVENT_MASK_PROPERTY_CHANGE : XCB_EVENT_MASK_NO_EVENT}
+	);
+}
+
+static void sendRange(
+	struct Source *source, long from, long length, xcb_window_t window, xcb_atom_t property, xcb_atom_t type
+) {
+	char *data = malloc(length ? length : 1);
+	if (!data) length = 0;
+	for (int k = 0; data && k < source->count; k++) {
+		struct Piece *piece = source->pieces + k;
+		long a = from > piece->start ? from : piece->start;
+		long b = from + length < piece->start + piece->length ? from + length : piece->start + piece->length;
+		if (a < b) memcpy(data + (a - from), piece->data + (a - piece->start), b - a);
+	}
+	xcb_change_property(clipboard.connection, XCB_PROP_MODE_REPLACE, window, property, type, 8, length, data);
+	free(data);
+}
+
+static void keep(struct Source *source) {
+	if (!source || source->kept) return;
+	char *kept = malloc(source->length ? source->length : 1);
+	struct Piece *piece = malloc(sizeof(struct Piece));
+	if (!kept || !piece) {
+		free(kept);
+		free(piece);
+		free(source->pieces);
+		source->pieces = NULL;
+		source->count = 0;
+		source->length = 0;
+		return;
+	}
+	for (int k = 0; k < source->count; k++) {
+		memcpy(kept + source->pieces[k].start, source->pieces[k].data, source->pieces[k].length);
+	}
+	free(source->pieces);
+	*piece = (struct Piece) {.data = kept, .length = source->length};
+	source->pieces = piece;
+	source->count = 1;
+	source->kept = kept;
+}
+
+static void release(struct Source *source) {
+	if (!source || --source->references > 0) return;
+	free(source->pieces);
+	free(source->kept);
+	free(source);
+}
@@ -4,9 +4,16 @@
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 
+#include "document.h"
+
 void clipboard_init(xcb_connection_t *, xcb_window_t, char *label);
-int clipboard_get(char *str, int length, int offset);
-void clipboard_set(char *str, int length);
+char *clipboard_get(long *length);
+xcb_generic_event_t *clipboard_nextEvent();
+bool clipboard_pending();
+bool clipboard_expire();
+void clipboard_set(struct Piece *pieces, int count, long length);
+void clipboard_keep();
 void clipboard_selectionRequest(xcb_selection_request_event_t *event);
+void clipboard_propertyNotify(xcb_property_notify_event_t *event);
 
 #endif
@@ -0,0 +1,1411 @@
+//for realpath
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/xattr.h>
+#endif
+
+#include "document.h"
+#include "stats.h"
+
+#define BLOCK_SIZE 65536
+
+static char *defaultstr = "This is a scratch document, it isn't from a file, and thus will not be saved.";
+
+//for busError to find the mapping a fault is in
+//the SIGBUS handler only reads ranges, start is set last and cleared first so it never sees half of one
+static volatile struct {
+	uintptr_t start, length;
+	sig_atomic_t lost;
+} ranges[MAPPINGS];
+static pthread_mutex_t rangesLock = PTHREAD_MUTEX_INITIALIZER;
+static int zeroes = -1;
+static long pageSize;
+
+static void release(doc_t *document);
+static void collect(doc_t *document);
+static long pinned(doc_t *document, struct Piece *pieces, int count);
+static bool inMapping(doc_t *document, const char *data);
+static bool unmap(doc_t *document, struct Piece *pieces, int count, struct stat *file);
+static int byAddress(const void *a, const void *b);
+static struct Mapping *map(doc_t *document, int fd, struct stat *st);
+static void unmapFile(struct Mapping *mapping);
+static bool lose(doc_t *document, struct Mapping *mapping, long from);
+static void busError(int signal, siginfo_t *info, void *context);
+static void keepTail(doc_t *document, int fd);
+static bool appended(doc_t *document, int fd, long known);
+static bool readFrom(doc_t *document, int fd, long from, long to);
+static enum Refresh spliceFile(doc_t *document, int fd, struct stat *st);
+static long matching(doc_t *document, const char *data, long length, long limit, bool back);
+static void splice(doc_t *document, long where, long removed, const char *data, long inserted);
+static bool finishSave(doc_t *document);
+static void *writeSave(void *argument);
+static bool writeTemporary(struct Save *saving, char *temp);
+static bool writeInPlace(struct Save *saving);
+static bool writePieces(struct Save *saving, int fd);
+static void copyAttributes(const char *from, int fd);
+static void readAll(doc_t *document, int fd);
+static bool startLoading(doc_t *document, int fd);
+static void *loadStream(void *argument);
+static void stopLoading(doc_t *document);
+static long placeText(doc_t *document, int k, const char *added, long length, bool merge);
+static bool placePieces(doc_t *document, int k, struct Piece *pieces, int count);
+static void removeText(doc_t *document, long where, long length);
+static long apply(doc_t *document, struct Edit *edit, bool forward);
+static struct Edit *record(doc_t *document, long where, bool inserted, long length, const char *data);
+static bool extend(struct Journal *journal, struct Edit *last, const char *data, bool front);
+static bool reserve(struct Journal *journal, int pieces);
+static void forget(doc_t *document);
+static void clearJournal(struct Journal *journal);
+static long position(struct Journal *journal);
+static char *append(doc_t *document, const char *data, long length);
+static int findPiece(doc_t *document, long where);
+static int split(doc_t *document, long where);
+static int place(doc_t *document, int at, const char *data, long length);
+static void reindex(doc_t *document, int from);
+static void extendIndex(doc_t *document, int upto);
+static long countNewlines(const char *data, long length);
+static void damage(doc_t *document, long where, long removed, long inserted);
+static void moveViews(doc_t *document, long where, long removed, long inserted);
+
+//load: maps the file and describes it with pieces, so opening takes about the same time regardless of size
+doc_t *load(doc_t *document, char *path) {
+	if (!document) {
+		document = calloc(1,sizeof(doc_t));
+		if (!document) return NULL;
+		pthread_mutex_init(&document->saving.lock, NULL);
+		pthread_mutex_init(&document->loading.lock, NULL);
+		document->journal.limit = JOURNAL_LIMIT;
+	}
+	release(document);
+	if (!path && !document->path) {
+		if (!place(document, 0, defaultstr, strlen(defaultstr))) return NULL;
+		document->length = strlen(defaultstr);
+	} else {
+		if (!document->path) document->path = path;
+		int fd = open(document->path, O_RDONLY);
+		struct stat st;
+		memset(&document->file, 0, sizeof(struct stat));
+		if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) document->file = st;
+		struct Mapping *mapping = document->file.st_size > 0 ? map(document, fd, &st) : NULL;
+		if (mapping) {
+			for (long i = 0; i < st.st_size; i += CHUNK_SIZE) {
+				long length = st.st_size - i < CHUNK_SIZE ? st.st_size - i : CHUNK_SIZE;
+				if (!place(document, document->count, mapping->data + i, length)) {
+					close(fd);
+					return NULL;
+				}
+			}
+			document->length = st.st_size;
+		}
+		if (!mapping && fd >= 0 && startLoading(document, fd)) fd = -1;
+		if (!mapping && fd >= 0) readAll(document, fd);
+		if (fd >= 0) keepTail(document, fd);
+		if (fd >= 0) close(fd);
+	}
+	reindex(document, 0);
+	clearJournal(&document->journal);
+	document->synced = position(&document->journal);
+	for (struct View *view = document->views; view; view = view->next) {
+		view->scroll = view->cursor = view->selection = 0;
+		view->scrollOffset = 0;
+	}
+	return document;
+}
+
+void unload(doc_t *document) {
+	release(document);
+	free(document->pieces);
+	free(document->journal.edits);
+	free(document->journal.arena);
+	free(document->saving.target);
+	free(document->path);
+	pthread_mutex_destroy(&document->saving.lock);
+	pthread_mutex_destroy(&document->loading.lock);
+	free(document);
+}
+
+//refresh: reads only what was appended if that's all that changed, or splices in the part that
+//differs if the file was replaced, a file changed in place under the mapping needs a reload
+enum Refresh refresh(doc_t *document) {
+	if (!document->path) return REFRESH_NONE;
+	pthread_mutex_lock(&document->saving.lock);
+	bool saving = document->saving.state != SAVE_IDLE;
+	pthread_mutex_unlock(&document->saving.lock);
+	if (saving || document->loading.active) return REFRESH_LATER;
+	int fd = open(document->path, O_RDONLY);
+	struct stat st;
+	//the file can be missing for a moment while it's being replaced
+	if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		if (fd >= 0) close(fd);
+		return REFRESH_NONE;
+	}
+	struct stat *known = &document->file;
+	bool same = st.st_dev == known->st_dev && st.st_ino == known->st_ino;
+	enum Refresh result = REFRESH_NONE;
+	//pages past the new end of the file are gone from under the mapping
+	if (same && st.st_size < known->st_size && pageSize) {
+		long from = (st.st_size + pageSize-1) / pageSize * pageSize;
+		for (struct Mapping *m = document->mappings; m; m = m->next) {
+			if (m->device == st.st_dev && m->inode == st.st_ino) lose(document, m, from);
+		}
+	}
+	if (
+		same && st.st_size == known->st_size
+		&& st.st_mtim.tv_sec == known->st_mtim.tv_sec && st.st_mtim.tv_nsec == known->st_mtim.tv_nsec
+	) {
+		result = REFRESH_NONE;
+	} else if (position(&document->journal) != document->synced || document->following.dropped) {
+		result = REFRESH_EDITED;
+	} else if (same && st.st_size > known->st_size && appended(document, fd, known->st_size)) {
+		result = readFrom(document, fd, known->st_size, st.st_size) ? REFRESH_APPENDED : REFRESH_RELOAD;
+	} else {
+		bool mapped = false;
+		for (struct Mapping *m = document->mappings; m; m = m->next) {
+			mapped |= m->device == st.st_dev && m->inode == st.st_ino;
+		}
+		result = mapped ? REFRESH_RELOAD : spliceFile(document, fd, &st);
+	}
+	if (result == REFRESH_APPENDED || result == REFRESH_SPLICED || result == REFRESH_NONE) {
+		*known = st;
+		keepTail(document, fd);
+	}
+	if (result == REFRESH_SPLICED) document->synced = position(&document->journal);
+	close(fd);
+	return result;
+}
+
+void reload(doc_t *document) {
+	struct View *views = document->views;
+	document->views = NULL;
+	load(document, NULL);
+	document->views = views;
+	for (struct View *view = views; view; view = view->next) {
+		clearLayout(&view->layout);
+		view->damage = (struct Damage) {0, LONG_MAX/2, 0, 1};
+		if (view->cursor > document->length) view->cursor = document->length;
+		if (view->selection > document->length) view->selection = document->length;
+		if (view->scroll > document->length) view->scroll = document->length;
+	}
+}
+
+bool startFollowing(doc_t *document, long limit) {
+	struct Follow *following = &document->following;
+	following->limit = limit;
+	if (following->active) return true;
+	if (!document->path || document->loading.active) return false;
+	int fd = open(document->path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	bool same = st.st_dev == document->file.st_dev && st.st_ino == document->file.st_ino;
+	following->fd = fd;
+	following->read = same ? document->file.st_size : st.st_size;
+	following->active = true;
+	following->truncated = false;
+	return true;
+}
+
+void stopFollowing(doc_t *document) {
+	struct Follow *following = &document->following;
+	if (!following->active) return;
+	close(following->fd);
+	following->active = false;
+}
+
+//followMore: reads up to FOLLOW_BATCH, going on to the file now at the path once the old one is read to its end
+bool followMore(doc_t *document) {
+	struct Follow *following = &document->following;
+	struct stat st, now;
+	if (!following->active || fstat(following->fd, &st)) return false;
+	//the text reads as zeroes past the new end until trim drops it, as logs are often cut short in place
+	if (st.st_size < following->read && !following->truncated) {
+		following->truncated = true;
+		long from = (st.st_size + pageSize-1) / pageSize * pageSize;
+		for (struct Mapping *m = document->mappings; m && pageSize; m = m->next) {
+			if (m->device == st.st_dev && m->inode == st.st_ino) lose(document, m, from);
+		}
+	}
+	if (following->truncated) return true;
+	if (
+		st.st_size == following->read && stat(document->path, &now) == 0 && S_ISREG(now.st_mode)
+		&& (now.st_dev != st.st_dev || now.st_ino != st.st_ino)
+	) {
+		int fd = open(document->path, O_RDONLY);
+		if (fd < 0) return false;
+		close(following->fd);
+		following->fd = fd;
+		following->read = 0;
+		if (fstat(fd, &st)) return false;
+	}
+	if (st.st_size == following->read) return false;
+	long to = st.st_size - following->read > FOLLOW_BATCH ? following->read + FOLLOW_BATCH : st.st_size;
+	if (!readFrom(document, following->fd, following->read, to)) return false;
+	following->read = to;
+	document->file = st;
+	document->file.st_size = to;
+	keepTail(document, following->fd);
+	return to < st.st_size;
+}
+
+//trim: drops the oldest text down to three quarters of the limit, or all of it once the file was cut short,
+//nothing outside the document may point into the text
+bool trim(doc_t *document) {
+	struct Follow *following = &document->following;
+	bool over = following->limit && document->length > following->limit;
+	if (!over && !following->truncated) return false;
+	pthread_mutex_lock(&document->saving.lock);
+	bool saving = document->saving.state != SAVE_IDLE;
+	pthread_mutex_unlock(&document->saving.lock);
+	if (saving) return false;
+	long cut = document->length - following->limit + following->limit/4;
+	for (long i = cut; !following->truncated && i < document->length && i < cut + 4096; i++) {
+		if (charAt(document, i-1) != '\n') continue;
+		cut = i;
+		break;
+	}
+	if (following->truncated) cut = document->length;
+	clearJournal(&document->journal);
+	removeText(document, 0, cut);
+	moveViews(document, 0, cut, 0);
+	following->dropped += cut;
+	if (following->truncated) {
+		following->truncated = false;
+		following->read = following->dropped = 0;
+		document->file.st_size = 0;
+		document->tailLength = 0;
+		document->cut = false;
+		document->synced = position(&document->journal);
+	}
+	collect(document);
+	return true;
+}
+
+void addView(doc_t *document, struct View *view) {
+	view->document = document;
+	view->scroll = view->cursor = view->selection = 0;
+	view->damage = (struct Damage) {0, LONG_MAX/2, 0, 1};
+	view->next = document->views;
+	document->views = view;
+}
+
+void removeView(struct View *view) {
+	struct View **link = &view->document->views;
+	while (*link && *link != view) link = &(*link)->next;
+	if (*link) *link = view->next;
+	freeLayout(&view->layout);
+}
+
+//save: writes from a copy of the piece list on another thread, a document cut short on disk has
+//zeroes where its text was and isn't saved
+bool save(doc_t *document) {
+	struct Save *saving = &document->saving;
+	if (!document->path || document->loading.active || cutShort(document)) return false;
+	pthread_mutex_lock(&saving->lock);
+	enum SaveState state = saving->state;
+	pthread_mutex_unlock(&saving->lock);
+	if (state != SAVE_IDLE) {
+		saving->again = true;
+		return true;
+	}
+	//a symlink is followed so that it's the file it points to that's replaced
+	free(saving->target);
+	saving->target = realpath(document->path, NULL);
+	saving->exists = saving->target && stat(saving->target, &saving->file) == 0;
+	if (!saving->target) saving->target = strdup(document->path);
+	if (!saving->target) return false;
+	if (!saving->exists) {
+		mode_t mask = umask(0);
+		umask(mask);
+		saving->file.st_mode = 0666 & ~mask;
+	}
+	//writing over the file changes what its mapping shows, so the text is copied out of it first
+	saving->inPlace = savesInPlace(document);
+	if (saving->inPlace) {
+		struct Journal *journal = &document->journal;
+		if (
+			!unmap(document, document->pieces, document->count, &saving->file)
+			|| !unmap(document, journal->arena, journal->used, &saving->file)
+		) {
+			return false;
+		}
+		journal->bytes = pinned(document, journal->arena, journal->used);
+		collect(document);
+	}
+	saving->pieces = malloc((document->count ? document->count : 1) * sizeof(struct Piece));
+	if (!saving->pieces) return false;
+	memcpy(saving->pieces, document->pieces, document->count * sizeof(struct Piece));
+	saving->count = document->count;
+	saving->written = 0;
+	saving->length = document->length;
+	saving->state = SAVE_WRITING;
+	saving->again = false;
+	saving->position = position(&document->journal);
+	if (pthread_create(&saving->thread, NULL, writeSave, document)) {
+		free(saving->pieces);
+		saving->state = SAVE_IDLE;
+		return false;
+	}
+	return true;
+}
+
+//reclaimable: enough was forgotten that freeing blocks is worth taking the clipboard and search out of them
+bool reclaimable(doc_t *document) {
+	if (document->journal.dropped < document->journal.limit || document->loading.active) return false;
+	pthread_mutex_lock(&document->saving.lock);
+	bool saving = document->saving.state != SAVE_IDLE;
+	pthread_mutex_unlock(&document->saving.lock);
+	return !saving;
+}
+
+//reclaim: nothing outside the document may point into the text
+void reclaim(doc_t *document) {
+	if (reclaimable(document)) collect(document);
+}
+
+//cutShort: faults leave their mark in the table, as the handler can't know which document they're in
+bool cutShort(doc_t *document) {
+	for (struct Mapping *m = document->mappings; m; m = m->next) document->cut |= ranges[m->range].lost;
+	return document->cut;
+}
+
+//savesInPlace: replacing the file would lose its other links or its owner
+bool savesInPlace(doc_t *document) {
+	struct stat st;
+	if (!document->path || stat(document->path, &st)) return false;
+	if (st.st_nlink > 1 || (st.st_uid != geteuid() && geteuid() != 0)) return true;
+	if (st.st_gid == getegid() || geteuid() == 0) return false;
+	int count = getgroups(0, NULL);
+	gid_t *groups = count > 0 ? malloc(count * sizeof(gid_t)) : NULL;
+	bool member = false;
+	if (groups) count = getgroups(count, groups);
+	for (int k = 0; groups && k < count; k++) member |= groups[k] == st.st_gid;
+	free(groups);
+	return !member;
+}
+
+enum SaveState saveProgress(doc_t *document, long *written, long *length) {
+	struct Save *saving = &document->saving;
+	pthread_mutex_lock(&saving->lock);
+	enum SaveState state = saving->state;
+	*written = saving->written;
+	*length = saving->length;
+	pthread_mutex_unlock(&saving->lock);
+	if ((state == SAVE_DONE || state == SAVE_FAILED) && finishSave(document)) return SAVE_WRITING;
+	return state;
+}
+
+void waitForSave(doc_t *document) {
+	long written, length;
+	while (saveProgress(document, &written, &length) == SAVE_WRITING) finishSave(document);
+}
+
+static bool finishSave(doc_t *document) {
+	struct Save *saving = &document->saving;
+	pthread_join(saving->thread, NULL);
+	free(saving->pieces);
+	int fd = saving->state == SAVE_DONE ? open(document->path, O_RDONLY) : -1;
+	if (fd >= 0 && fstat(fd, &document->file) == 0) {
+		document->synced = saving->position;
+		keepTail(document, fd);
+	}
+	if (fd >= 0) close(fd);
+	saving->state = SAVE_IDLE;
+	return saving->again && save(document);
+}
+
+//writeSave: replaces the file rather than truncating it, which would pull the text out from under the mapping
+static void *writeSave(void *argument) {
+	doc_t *document = argument;
+	struct Save *saving = &document->saving;
+	bool written = false;
+	char *temp = saving->inPlace ? NULL : malloc(strlen(saving->target) + 8);
+	if (saving->inPlace) {
+		written = writeInPlace(saving);
+	} else if (temp) {
+		sprintf(temp, "%s.XXXXXX", saving->target);
+		written = writeTemporary(saving, temp);
+		free(temp);
+	}
+	pthread_mutex_lock(&saving->lock);
+	saving->state = written ? SAVE_DONE : SAVE_FAILED;
+	pthread_mutex_unlock(&saving->lock);
+	return NULL;
+}
+
+//writeTemporary: the owner goes before the mode, as changing it clears the setuid bits
+static bool writeTemporary(struct Save *saving, char *temp) {
+	int fd = mkstemp(temp);
+	if (fd < 0) return false;
+	struct stat *st = &saving->file;
+	bool failed = saving->exists && (st->st_uid != geteuid() || st->st_gid != getegid())
+		&& fchown(fd, st->st_uid, st->st_gid) != 0;
+	failed |= fchmod(fd, st->st_mode & 07777) != 0;
+	if (saving->exists) copyAttributes(saving->target, fd);
+	failed = failed || !writePieces(saving, fd);
+	failed |= close(fd) != 0;
+	if (failed || rename(temp, saving->target)) {
+		unlink(temp);
+		return false;
+	}
+	return true;
+}
+
+static bool writeInPlace(struct Save *saving) {
+	int fd = open(saving->target, O_WRONLY);
+	if (fd < 0) return false;
+	bool failed = !writePieces(saving, fd);
+	failed |= close(fd) != 0;
+	return !failed;
+}
+
+static bool writePieces(struct Save *saving, int fd) {
+	bool failed = false;
+	for (int k = 0; !failed && k < saving->count; k++) {
+		struct Piece *piece = saving->pieces + k;
+		for (long done = 0; !failed && done < piece->length;) {
+			ssize_t length = write(fd, piece->data + done, piece->length - done);
+			failed = length < 0 && errno != EINTR;
+			if (length > 0) done += length;
+		}
+		pthread_mutex_lock(&saving->lock);
+		saving->written += piece->length;
+		pthread_mutex_unlock(&saving->lock);
+	}
+	failed = failed || ftruncate(fd, saving->length) != 0;
+	failed = failed || fsync(fd) != 0;
+	return !failed;
+}
+
+static void copyAttributes(const char *from, int fd) {
+#ifdef __linux__
+	ssize_t size = listxattr(from, NULL, 0);
+	char *names = size > 0 ? malloc(size) : NULL;
+	if (names) size = listxattr(from, names, size);
+	for (char *name = names; names && size > 0 && name < names + size; name += strlen(name) + 1) {
+		ssize_t length = getxattr(from, name, NULL, 0);
+		char *value = length > 0 ? malloc(length) : NULL;
+		if (value && (length = getxattr(from, name, value, length)) >= 0) fsetxattr(fd, name, value, length, 0);
+		free(value);
+	}
+	free(names);
+#else
+	(void) from;
+	(void) fd;
+#endif
+}
+
+char charAt(doc_t *document, long i) {
+	if (i < 0 || i >= document->length) return 0;
+	struct Piece *piece = document->pieces + findPiece(document, i);
+	return piece->data[i - piece->start];
+}
+
+long lineOf(doc_t *document, long i) {
+	if (document->count == 0 || i <= 0) return 0;
+	int k = findPiece(document, i);
+	if (k == document->count) {
+		extendIndex(document, k-1);
+		return document->pieces[k-1].line + document->pieces[k-1].newlines;
+	}
+	extendIndex(document, k);
+	struct Piece *piece = document->pieces + k;
+	return piece->line + countNewlines(piece->data, i - piece->start);
+}
+
+long lineStart(doc_t *document, long line) {
+	if (line <= 0) return 0;
+	struct Piece *pieces = document->pieces;
+	while (document->indexed < document->count && (
+		document->indexed == 0
+		|| pieces[document->indexed-1].line + pieces[document->indexed-1].newlines < line
+	)) extendIndex(document, document->indexed);
+	int low = 0, high = document->indexed;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (pieces[middle].line + pieces[middle].newlines < line) low = middle + 1;
+		else high = middle;
+	}
+	if (low == document->indexed) return document->length;
+	struct Piece *piece = pieces + low;
+	const char *c = piece->data;
+	for (long n = line - piece->line; n > 0; n--) {
+		c = memchr(c, '\n', piece->length - (c - piece->data)) + 1;
+	}
+	return piece->start + (c - piece->data);
+}
+
+void copyOut(doc_t *document, long from, long to, char *out) {
+	if (from > to) {long _t = from; from = to; to = _t;}
+	for (int k = findPiece(document, from); from < to && k < document->count; k++) {
+		struct Piece *piece = document->pieces + k;
+		long end = piece->start + piece->length < to ? piece->start + piece->length : to;
+		memcpy(out, piece->data + (from - piece->start), end - from);
+		out += end - from;
+		from = end;
+	}
+}
+
+//snapshot: the pieces have starts relative to from, the caller frees them
+struct Piece *snapshot(doc_t *document, long from, long to, int *count) {
+	if (from > to) {long _t = from; from = to; to = _t;}
+	int first = findPiece(document, from);
+	int last = first;
+	while (last < document->count && document->pieces[last].start < to) last++;
+	struct Piece *pieces = malloc((last > first ? last - first : 1) * sizeof(struct Piece));
+	if (!pieces) return NULL;
+	*count = 0;
+	for (int k = first; k < last; k++) {
+		struct Piece *piece = document->pieces + k;
+		long a = from > piece->start ? from : piece->start;
+		long b = to < piece->start + piece->length ? to : piece->start + piece->length;
+		pieces[(*count)++] = (struct Piece) {
+			.data = piece->data + (a - piece->start), .length = b - a, .start = a - from, .newlines = -1
+		};
+	}
+	return pieces;
+}
+
+//undamaged: positions inside the damaged span all map to its start
+long undamaged(struct View *view, long i) {
+	struct Damage *d = &view->damage;
+	if (i < 0 || !d->active || i < d->from) return i;
+	if (i >= d->to - d->delta) return i + d->delta;
+	return d->from;
+}
+
+void doInsertAction(doc_t *document, long where, long length, char *data) {
+	if (length <= 0) return;
+	char *added = append(document, data, length);
+	if (!added) return;
+	int k = split(document, where);
+	if (k < 0) return;
+	long placed = placeText(document, k, added, length, added != document->blocks->data);
+	if (!record(document, where, true, placed, added)) clearJournal(&document->journal);
+	moveViews(document, where, 0, placed);
+}
+
+void doDeleteAction(doc_t *document, long from, long to) {
+	long where = from < to ? from : to;
+	long length = from < to ? to-from : from-to;
+	if (length <= 0 || where < 0 || where + length > document->length) return;
+	struct Edit *edit = NULL;
+	if (length == 1) {
+		struct Piece *piece = document->pieces + findPiece(document, where);
+		edit = record(document, where, false, 1, piece->data + (where - piece->start));
+	} else {
+		int count;
+		struct Piece *pieces = snapshot(document, where, where+length, &count);
+		if (pieces && reserve(&document->journal, count)) edit = record(document, where, false, length, NULL);
+		if (edit) {
+			memcpy(document->journal.arena + edit->first, pieces, count * sizeof(struct Piece));
+			edit->count = count;
+			document->journal.used += count;
+			document->journal.bytes += pinned(document, pieces, count);
+		}
+		free(pieces);
+	}
+	if (!edit) clearJournal(&document->journal);
+	removeText(document, where, length);
+	moveViews(document, where, length, 0);
+}
+
+const char *stash(doc_t *document, const char *data, long length) {
+	return append(document, data, length);
+}
+
+void replacePieces(doc_t *document, struct Piece *pieces, int count, long length) {
+	struct Journal *journal = &document->journal;
+	long removed = document->length;
+	struct Edit *edit = NULL;
+	if (reserve(journal, document->count + count)) edit = record(document, 0, false, removed, NULL);
+	if (edit) {
+		memcpy(journal->arena + edit->first, document->pieces, document->count * sizeof(struct Piece));
+		edit->count = document->count;
+		journal->used += document->count;
+		journal->bytes += pinned(document, document->pieces, document->count);
+		if (length > 0) {
+			joinEdits(document);
+			edit = record(document, 0, true, length, NULL);
+		}
+		if (edit && edit->inserted) {
+			memcpy(journal->arena + edit->first, pieces, count * sizeof(struct Piece));
+			edit->count = count;
+			journal->used += count;
+			journal->bytes += pinned(document, pieces, count);
+		}
+	}
+	//the edits before a replace the journal couldn't hold would be undone onto the wrong text
+	if (!edit) clearJournal(journal);
+	free(document->pieces);
+	document->pieces = pieces;
+	document->count = document->capacity = count;
+	document->hint = 0;
+	document->length = length;
+	reindex(document, 0);
+	layoutEdit(document, 0, removed, length);
+	damage(document, 0, removed, length);
+}
+
+void joinEdits(doc_t *document) {
+	document->journal.joining = true;
+}
+
+long undo(doc_t *document) {
+	struct Journal *journal = &document->journal;
+	if (journal->done == 0) return -1;
+	long step = journal->edits[journal->done-1].step, at = -1;
+	while (journal->done > 0 && journal->edits[journal->done-1].step == step) {
+		at = apply(document, journal->edits + --journal->done, false);
+	}
+	journal->joining = false;
+	return at;
+}
+
+long redo(doc_t *document) {
+	struct Journal *journal = &document->journal;
+	if (journal->done == journal->count) return -1;
+	long step = journal->edits[journal->done].step, at = -1;
+	while (journal->done < journal->count && journal->edits[journal->done].step == step) {
+		at = apply(document, journal->edits + journal->done++, true);
+	}
+	journal->joining = false;
+	return at;
+}
+
+static long apply(doc_t *document, struct Edit *edit, bool forward) {
+	if (edit->inserted == forward) {
+		int k = split(document, edit->where);
+		if (k < 0 || !placePieces(document, k, document->journal.arena + edit->first, edit->count)) return edit->where;
+		moveViews(document, edit->where, 0, edit->length);
+		return edit->where + edit->length;
+	}
+	removeText(document, edit->where, edit->length);
+	moveViews(document, edit->where, edit->length, 0);
+	return edit->where;
+}
+
+//record: single characters typed next to the last ones are merged into their edit, so a run of typing
+//is undone at once, data NULL leaves the pieces to the caller
+static struct Edit *record(doc_t *document, long where, bool inserted, long length, const char *data) {
+	struct Journal *journal = &document->journal;
+	if (length <= 0) return NULL;
+	if (journal->done < journal->count) {
+		int first = journal->edits[journal->done].first;
+		long bytes = pinned(document, journal->arena + first, journal->used - first);
+		journal->bytes -= bytes;
+		journal->dropped += bytes;
+		journal->used = first;
+		journal->count = journal->done;
+	}
+	bool typed = data && length == 1 && *data != '\n';
+	struct Edit *last = journal->count ? journal->edits + journal->count-1 : NULL;
+	if (typed && last && last->typed && last->inserted == inserted) {
+		bool back = !inserted && where + 1 == last->where;
+		bool ahead = where == (inserted ? last->where + last->length : last->where);
+		if ((back || ahead) && extend(journal, last, data, back)) {
+			journal->bytes += !inMapping(document, data);
+			journal->joining = false;
+			last->position = ++journal->positions;
+			return last;
+		}
+	}
+	
+	if (journal->count == journal->capacity) {
+		int capacity = journal->capacity ? journal->capacity*2 : 256;
+		struct Edit *edits = realloc(journal->edits, capacity * sizeof(struct Edit));
+		if (!edits) return NULL;
+		journal->edits = edits;
+		journal->capacity = capacity;
+	}
+	if (data && !reserve(journal, 1)) return NULL;
+	if (!journal->joining || !journal->count) journal->step++;
+	journal->joining = false;
+	struct Edit *edit = journal->edits + journal->count++;
+	journal->done = journal->count;
+	*edit = (struct Edit) {
+		.where = where, .length = length, .first = journal->used,
+		.inserted = inserted, .typed = typed, .step = journal->step,
+		.position = ++journal->positions
+	};
+	if (data) {
+		journal->arena[journal->used++] = (struct Piece) {.data = data, .length = length, .newlines = -1};
+		journal->bytes += inMapping(document, data) ? 0 : length;
+		edit->count = 1;
+	}
+	forget(document);
+	return journal->edits + journal->count-1;
+}
+
+static bool extend(struct Journal *journal, struct Edit *last, const char *data, bool front) {
+	struct Piece *pieces = journal->arena + last->first;
+	if (front && pieces->data == data + 1) {
+		pieces->data--;
+		pieces->length++;
+	} else if (!front && pieces[last->count-1].data + pieces[last->count-1].length == data) {
+		pieces[last->count-1].length++;
+	} else {
+		if (!reserve(journal, 1)) return false;
+		pieces = journal->arena + last->first;
+		struct Piece piece = {.data = data, .length = 1, .start = front ? 0 : last->length, .newlines = -1};
+		if (front) memmove(pieces + 1, pieces, last->count * sizeof(struct Piece));
+		pieces[front ? 0 : last->count] = piece;
+		last->count++;
+		journal->used++;
+	}
+	if (front) {
+		for (int i = 1; i < last->count; i++) pieces[i].start++;
+		last->where--;
+	}
+	last->length++;
+	return true;
+}
+
+static bool reserve(struct Journal *journal, int pieces) {
+	if (journal->used + pieces <= journal->size) return true;
+	int size = journal->size ? journal->size : 1024;
+	while (size < journal->used + pieces) size *= 2;
+	struct Piece *arena = realloc(journal->arena, size * sizeof(struct Piece));
+	if (!arena) return false;
+	journal->arena = arena;
+	journal->size = size;
+	return true;
+}
+
+//forget: the text the pieces point to counts too, as the add blocks it's in can't be freed until then
+static void forget(doc_t *document) {
+	struct Journal *journal = &document->journal;
+	while (
+		journal->count > 1
+		&& (long) (journal->count * sizeof(struct Edit) + journal->used * sizeof(struct Piece)) + journal->bytes
+			> journal->limit
+	) {
+		int edits = 0;
+		while (edits < journal->count && journal->edits[edits].step == journal->edits[0].step) edits++;
+		if (edits == journal->count) return;
+		int pieces = journal->edits[edits].first;
+		long bytes = pinned(document, journal->arena, pieces);
+		journal->bytes -= bytes;
+		journal->dropped += bytes;
+		journal->base = journal->edits[edits-1].position;
+		memmove(journal->edits, journal->edits + edits, (journal->count - edits) * sizeof(struct Edit));
+		memmove(journal->arena, journal->arena + pieces, (journal->used - pieces) * sizeof(struct Piece));
+		journal->count -= edits;
+		journal->done -= edits;
+		journal->used -= pieces;
+		for (int i = 0; i < journal->count; i++) journal->edits[i].first -= pieces;
+	}
+}
+
+static void clearJournal(struct Journal *journal) {
+	journal->dropped += journal->bytes;
+	journal->bytes = 0;
+	journal->count = journal->done = journal->used = 0;
+	journal->joining = false;
+	journal->base = ++journal->positions;
+}
+
+static long position(struct Journal *journal) {
+	return journal->done ? journal->edits[journal->done-1].position : journal->base;
+}
+
+static void removeText(doc_t *document, long where, long length) {
+	int a = split(document, where);
+	int b = split(document, where+length);
+	if (a < 0 || b < 0) return;
+	STAT(moved, (document->count - b) * sizeof(struct Piece));
+	memmove(
+		document->pieces + a, document->pieces + b,
+		(document->count - b) * sizeof(struct Piece)
+	);
+	document->count -= b-a;
+	document->length -= length;
+	reindex(document, a > 0 ? a-1 : 0);
+	layoutEdit(document, where, length, 0);
+	damage(document, where, length, 0);
+}
+
+bool loadMore(doc_t *document) {
+	struct Load *loading = &document->loading;
+	if (!loading->active) return false;
+	pthread_mutex_lock(&loading->lock);
+	bool finished = loading->finished;
+	while (loading->first) {
+		struct Block *block = loading->first;
+		if (block->used > loading->taken) {
+			placeText(
+				document, document->count, block->data + loading->taken,
+				block->used - loading->taken, loading->taken > 0
+			);
+			loading->taken = block->used;
+		}
+		//the loader still links the next block to the last one
+		if (!block->next && !finished) break;
+		loading->first = block->next;
+		loading->taken = 0;
+		block->size = block->used;
+		block->next = document->blocks;
+		document->blocks = block;
+	}
+	if (!loading->first) loading->last = NULL;
+	pthread_mutex_unlock(&loading->lock);
+	if (finished) {
+		pthread_join(loading->thread, NULL);
+		close(loading->fd);
+		loading->active = false;
+	}
+	return !finished;
+}
+
+static bool startLoading(doc_t *document, int fd) {
+	struct Load *loading = &document->loading;
+	loading->fd = fd;
+	loading->first = loading->last = NULL;
+	loading->taken = 0;
+	loading->finished = false;
+	loading->active = !pthread_create(&loading->thread, NULL, loadStream, loading);
+	return loading->active;
+}
+
+//loadStream: only the used count of a block is shared, the document never reads past it
+static void *loadStream(void *argument) {
+	struct Load *loading = argument;
+	struct Block *block = NULL;
+	for (;;) {
+		if (!block || block->used == block->size) {
+			block = malloc(sizeof(struct Block) + BLOCK_SIZE);
+			if (!block) break;
+			block->next = NULL;
+			block->used = 0;
+			block->size = BLOCK_SIZE;
+			pthread_mutex_lock(&loading->lock);
+			if (loading->last) loading->last->next = block;
+			else loading->first = block;
+			loading->last = block;
+			pthread_mutex_unlock(&loading->lock);
+		}
+		ssize_t length = read(loading->fd, block->data + block->used, block->size - block->used);
+		if (length < 0 && errno == EINTR) continue;
+		if (length <= 0) break;
+		pthread_mutex_lock(&loading->lock);
+		block->used += length;
+		pthread_mutex_unlock(&loading->lock);
+	}
+	pthread_mutex_lock(&loading->lock);
+	loading->finished = true;
+	pthread_mutex_unlock(&loading->lock);
+	return NULL;
+}
+
+static void stopLoading(doc_t *document) {
+	struct Load *loading = &document->loading;
+	if (!loading->active) return;
+	pthread_cancel(loading->thread);
+	pthread_join(loading->thread, NULL);
+	close(loading->fd);
+	while (loading->first) {
+		struct Block *next = loading->first->next;
+		free(loading->first);
+		loading->first = next;
+	}
+	loading->last = NULL;
+	loading->active = false;
+}
+
+static long placeText(doc_t *document, int k, const char *added, long length, bool merge) {
+	long where = k < document->count ? document->pieces[k].start : document->length;
+	struct Piece *previous = k > 0 ? document->pieces + k-1 : NULL;
+	long placed = 0;
+	if (
+		merge && previous
+		&& previous->data + previous->length == added
+		&& previous->length + length <= CHUNK_SIZE
+	) {
+		previous->length += length;
+		previous->newlines = -1;
+		placed = length;
+	}
+	for (int at = k; placed < length; at++) {
+		long chunk = length - placed < CHUNK_SIZE ? length - placed : CHUNK_SIZE;
+		if (!place(document, at, added + placed, chunk)) break;
+		placed += chunk;
+	}
+	document->length += placed;
+	reindex(document, k > 0 ? k-1 : 0);
+	layoutEdit(document, where, 0, placed);
+	damage(document, where, 0, placed);
+	return placed;
+}
+
+//placePieces: a whole edit goes back with one move of the pieces after it and one reindex
+static bool placePieces(doc_t *document, int k, struct Piece *pieces, int count) {
+	int slots = 0;
+	for (int i = 0; i < count; i++) slots += (pieces[i].length + CHUNK_SIZE-1) / CHUNK_SIZE;
+	if (document->count + slots > document->capacity) {
+		int capacity = document->capacity ? document->capacity : 64;
+		while (capacity < document->count + slots) capacity *= 2;
+		struct Piece *grown = realloc(document->pieces, capacity * sizeof(struct Piece));
+		if (!grown) return false;
+		STAT(reallocs, 1);
+		document->pieces = grown;
+		document->capacity = capacity;
+	}
+	long where = k < document->count ? document->pieces[k].start : document->length, placed = 0;
+	STAT(moved, (document->count - k) * sizeof(struct Piece));
+	memmove(document->pieces + k + slots, document->pieces + k, (document->count - k) * sizeof(struct Piece));
+	int at = k;
+	for (int i = 0; i < count; i++) {
+		for (long done = 0; done < pieces[i].length; done += CHUNK_SIZE) {
+			long chunk = pieces[i].length - done < CHUNK_SIZE ? pieces[i].length - done : CHUNK_SIZE;
+			document->pieces[at++] = (struct Piece) {.data = pieces[i].data + done, .length = chunk, .newlines = -1};
+			placed += chunk;
+		}
+	}
+	document->count += slots;
+	document->length += placed;
+	reindex(document, k > 0 ? k-1 : 0);
+	layoutEdit(document, where, 0, placed);
+	damage(document, where, 0, placed);
+	return true;
+}
+
+static void release(doc_t *document) {
+	waitForSave(document);
+	stopLoading(document);
+	stopFollowing(document);
+	document->following.dropped = 0;
+	document->cut = false;
+	while (document->mappings) {
+		struct Mapping *next = document->mappings->next;
+		unmapFile(document->mappings);
+		document->mappings = next;
+	}
+	while (document->blocks) {
+		struct Block *next = document->blocks->next;
+		free(document->blocks);
+		document->blocks = next;
+	}
+	document->count = 0;
+	document->hint = 0;
+	document->indexed = 0;
+	document->length = 0;
+	for (struct View *view = document->views; view; view = view->next) {
+		clearLayout(&view->layout);
+		view->damage = (struct Damage) {0, LONG_MAX/2, 0, 1};
+	}
+}
+
+//collect: frees what neither the text nor the journal points into
+static void collect(doc_t *document) {
+	struct Journal *journal = &document->journal;
+	int pieces = document->count + journal->used;
+	int count = 0;
+	for (struct Block *block = document->blocks; block; block = block->next) count++;
+	struct Block **blocks = malloc(count * sizeof(struct Block *));
+	bool *used = calloc(count, sizeof(bool));
+	if (!blocks || !used) {
+		free(blocks);
+		free(used);
+		return;
+	}
+	count = 0;
+	for (struct Block *block = document->blocks; block; block = block->next) blocks[count++] = block;
+	qsort(blocks, count, sizeof(struct Block *), byAddress);
+	for (int k = 0; k < pieces; k++) {
+		uintptr_t data = (uintptr_t) (k < document->count ? document->pieces[k] : journal->arena[k - document->count]).data;
+		int low = 0, high = count;
+		while (high - low > 1) {
+			int middle = (low + high) / 2;
+			if ((uintptr_t) blocks[middle] <= data) low = middle;
+			else high = middle;
+		}
+		struct Block *block = count ? blocks[low] : NULL;
+		if (block && data >= (uintptr_t) block->data && data < (uintptr_t) (block->data + block->size)) {
+			used[low] = true;
+		}
+	}
+	for (int k = 0; k < count; k++) {
+		if (used[k] || blocks[k] == document->blocks) continue;
+		struct Block **link = &document->blocks;
+		while (*link != blocks[k]) link = &(*link)->next;
+		*link = blocks[k]->next;
+		free(blocks[k]);
+	}
+	free(blocks);
+	free(used);
+	
+	for (struct Mapping **link = &document->mappings; *link;) {
+		struct Mapping *mapping = *link;
+		bool mapped = false;
+		for (int k = 0; k < pieces && !mapped; k++) {
+			const char *data = (k < document->count ? document->pieces[k] : journal->arena[k - document->count]).data;
+			mapped = data >= mapping->data && data < mapping->data + mapping->length;
+		}
+		if (mapped) {
+			link = &mapping->next;
+			continue;
+		}
+		*link = mapping->next;
+		unmapFile(mapping);
+	}
+	journal->dropped = 0;
+}
+
+static long pinned(doc_t *document, struct Piece *pieces, int count) {
+	long bytes = 0;
+	for (int k = 0; k < count; k++) bytes += inMapping(document, pieces[k].data) ? 0 : pieces[k].length;
+	return bytes;
+}
+
+static bool inMapping(doc_t *document, const char *data) {
+	for (struct Mapping *m = document->mappings; m; m = m->next) {
+		if (data >= m->data && data < m->data + m->length) return true;
+	}
+	return false;
+}
+
+static bool unmap(doc_t *document, struct Piece *pieces, int count, struct stat *file) {
+	for (int k = 0; k < count; k++) {
+		bool mapped = false;
+		for (struct Mapping *m = document->mappings; m && !mapped; m = m->next) {
+			mapped = m->device == file->st_dev && m->inode == file->st_ino
+				&& pieces[k].data >= m->data && pieces[k].data < m->data + m->length;
+		}
+		if (!mapped) continue;
+		const char *added = append(document, pieces[k].data, pieces[k].length);
+		if (!added) return false;
+		pieces[k].data = added;
+	}
+	return true;
+}
+
+static int byAddress(const void *a, const void *b) {
+	uintptr_t x = (uintptr_t) *(struct Block *const *) a, y = (uintptr_t) *(struct Block *const *) b;
+	return x < y ? -1 : x > y;
+}
+
+static struct Mapping *map(doc_t *document, int fd, struct stat *st) {
+	if (zeroes < 0) {
+		zeroes = open("/dev/zero", O_RDONLY);
+		if (zeroes < 0) return NULL;
+		pageSize = sysconf(_SC_PAGESIZE);
+		struct sigaction action = {.sa_sigaction = busError, .sa_flags = SA_SIGINFO};
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGBUS, &action, NULL);
+	}
+	struct Mapping *mapping = malloc(sizeof(struct Mapping));
+	if (!mapping) return NULL;
+	pthread_mutex_lock(&rangesLock);
+	mapping->range = 0;
+	while (mapping->range < MAPPINGS && ranges[mapping->range].start) mapping->range++;
+	mapping->data = mapping->range < MAPPINGS ? mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (mapping->data == MAP_FAILED) {
+		pthread_mutex_unlock(&rangesLock);
+		free(mapping);
+		return NULL;
+	}
+	ranges[mapping->range].length = st->st_size;
+	ranges[mapping->range].lost = 0;
+	ranges[mapping->range].start = (uintptr_t) mapping->data;
+	pthread_mutex_unlock(&rangesLock);
+	mapping->length = st->st_size;
+	mapping->device = st->st_dev;
+	mapping->inode = st->st_ino;
+	mapping->next = document->mappings;
+	document->mappings = mapping;
+	return mapping;
+}
+
+static void unmapFile(struct Mapping *mapping) {
+	pthread_mutex_lock(&rangesLock);
+	ranges[mapping->range].start = 0;
+	pthread_mutex_unlock(&rangesLock);
+	munmap(mapping->data, mapping->length);
+	free(mapping);
+}
+
+static bool lose(doc_t *document, struct Mapping *mapping, long from) {
+	if (from >= mapping->length) return true;
+	void *zeroed = mmap(
+		mapping->data + from, mapping->length - from, PROT_READ, MAP_PRIVATE | MAP_FIXED, zeroes, 0
+	);
+	if (zeroed == MAP_FAILED) return false;
+	document->cut = true;
+	return true;
+}
+
+//busError: pages of a mapping past the end of its file are made zeroes and the read tried again,
+//the fault can be on any thread so only the table is looked at, and mmap is just a system call
+static void busError(int signal, siginfo_t *info, void *context) {
+	(void) context;
+	uintptr_t address = (uintptr_t) info->si_addr;
+	for (int k = 0; k < MAPPINGS; k++) {
+		uintptr_t start = ranges[k].start, length = ranges[k].length;
+		if (!start || address < start || address >= start + length) continue;
+		uintptr_t from = (address - start) / pageSize * pageSize;
+		void *zeroed = mmap((void *) (start + from), length - from, PROT_READ, MAP_PRIVATE | MAP_FIXED, zeroes, 0);
+		if (zeroed == MAP_FAILED) break;
+		ranges[k].lost = 1;
+		return;
+	}
+	struct sigaction action = {.sa_handler = SIG_DFL};
+	sigemptyset(&action.sa_mask);
+	sigaction(signal, &action, NULL);
+}
+
+static void keepTail(doc_t *document, int fd) {
+	long size = document->file.st_size;
+	long length = size < (long) sizeof(document->tail) ? size : (long) sizeof(document->tail);
+	document->tailLength = length > 0 && pread(fd, document->tail, length, size - length) == length ? length : 0;
+}
+
+//appended: the last stretch is compared to catch a file that was written over rather than added to
+static bool appended(doc_t *document, int fd, long known) {
+	if (document->length != known) return false;
+	char file[sizeof(document->tail)];
+	long length = known < (long) sizeof(file) ? known : (long) sizeof(file);
+	if (length != document->tailLength || pread(fd, file, length, known - length) != length) return false;
+	return !memcmp(file, document->tail, length);
+}
+
+static bool readFrom(doc_t *document, int fd, long from, long to) {
+	char buffer[BLOCK_SIZE];
+	while (from < to) {
+		ssize_t length = pread(fd, buffer, to - from < BLOCK_SIZE ? to - from : BLOCK_SIZE, from);
+		if (length < 0 && errno == EINTR) continue;
+		if (length <= 0) return false;
+		char *added = append(document, buffer, length);
+		if (!added) return false;
+		placeText(document, document->count, added, length, true);
+		from += length;
+	}
+	return true;
+}
+
+static enum Refresh spliceFile(doc_t *document, int fd, struct stat *st) {
+	struct Mapping *mapping = st->st_size > 0 ? map(document, fd, st) : NULL;
+	if (st->st_size > 0 && !mapping) return REFRESH_RELOAD;
+	const char *data = mapping ? mapping->data : "";
+	long shorter = document->length < st->st_size ? document->length : st->st_size;
+	long prefix = matching(document, data, st->st_size, shorter, false);
+	long suffix = matching(document, data, st->st_size, shorter - prefix, true);
+	long removed = document->length - prefix - suffix, inserted = st->st_size - prefix - suffix;
+	if (!removed && !inserted) {
+		//nothing points into the new mapping, the one kept from before is just as good
+		if (mapping) {
+			document->mappings = mapping->next;
+			unmapFile(mapping);
+		}
+		return REFRESH_NONE;
+	}
+	splice(document, prefix, removed, data + prefix, inserted);
+	return REFRESH_SPLICED;
+}
+
+static long matching(doc_t *document, const char *data, long length, long limit, bool back) {
+	long same = 0;
+	for (int i = 0; i < document->count && same < limit; i++) {
+		struct Piece *piece = document->pieces + (back ? document->count-1 - i : i);
+		long n = piece->length < limit - same ? piece->length : limit - same;
+		const char *a = back ? piece->data + piece->length - n : piece->data;
+		const char *b = back ? data + length - same - n : data + same;
+		if (!memcmp(a, b, n)) {
+			same += n;
+			continue;
+		}
+		long k = 0;
+		if (back) while (a[n-1 - k] == b[n-1 - k]) k++;
+		else while (a[k] == b[k]) k++;
+		return same + k;
+	}
+	return same;
+}
+
+static void splice(doc_t *document, long where, long removed, const char *data, long inserted) {
+	struct Journal *journal = &document->journal;
+	int count = 0, chunks = (inserted + CHUNK_SIZE-1) / CHUNK_SIZE;
+	struct Piece *pieces = removed > 0 ? snapshot(document, where, where+removed, &count) : NULL;
+	bool recorded = (!removed || pieces) && reserve(journal, count + chunks);
+	struct Edit *edit = recorded && removed > 0 ? record(document, where, false, removed, NULL) : NULL;
+	if (edit) {
+		memcpy(journal->arena + edit->first, pieces, count * sizeof(struct Piece));
+		edit->count = count;
+		journal->used += count;
+	}
+	recorded &= !removed || edit;
+	if (recorded && inserted > 0) {
+		if (removed > 0) joinEdits(document);
+		edit = record(document, where, true, inserted, NULL);
+		for (int c = 0; edit && c < chunks; c++) {
+			long start = (long) c * CHUNK_SIZE;
+			long length = inserted - start < CHUNK_SIZE ? inserted - start : CHUNK_SIZE;
+			journal->arena[journal->used++] = (struct Piece) {
+				.data = data + start, .length = length, .start = start, .newlines = -1
+			};
+		}
+		if (edit) edit->count = chunks;
+		recorded = edit;
+	}
+	//the edits before a splice the journal couldn't hold would be undone onto the wrong text
+	if (!recorded) clearJournal(journal);
+	free(pieces);
+	
+	if (removed > 0) removeText(document, where, removed);
+	int k = inserted > 0 ? split(document, where) : -1;
+	if (k >= 0) placeText(document, k, data, inserted, false);
+	for (struct View *view = document->views; view; view = view->next) {
+		long *positions[] = {&view->cursor, &view->selection, &view->scroll};
+		for (int j = 0; j < 3; j++) {
+			long *p = positions[j];
+			if (*p >= where + removed && *p > where) *p += inserted - removed;
+			else if (*p > where + inserted) *p = where + inserted;
+		}
+	}
+}
+
+static void readAll(doc_t *document, int fd) {
+	char buffer[BLOCK_SIZE];
+	ssize_t length;
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+		doInsertAction(document, document->length, length, buffer);
+	}
+}
+
+static char *append(doc_t *document, const char *data, long length) {
+	struct Block *block = document->blocks;
+	if (!block || block->size - block->used < length) {
+		long size = length > BLOCK_SIZE ? length : BLOCK_SIZE;
+		block = malloc(sizeof(struct Block) + size);
+		if (!block) return NULL;
+		STAT(reallocs, 1);
+		block->next = document->blocks;
+		block->used = 0;
+		block->size = size;
+		document->blocks = block;
+	}
+	char *added = block->data + block->used;
+	memcpy(added, data, length);
+	block->used += length;
+	return added;
+}
+
+static int findPiece(doc_t *document, long where) {
+	struct Piece *pieces = document->pieces;
+	int k = document->hint;
+	if (k < document->count && where >= pieces[k].start && where < pieces[k].start + pieces[k].length) {
+		return k;
+	}
+	if (where >= document->length) return document->count;
+	int low = 0, high = document->count - 1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (pieces[middle].start <= where) low = middle;
+		else high = middle - 1;
+	}
+	return document->hint = low;
+}
+
+static int split(doc_t *document, long where) {
+	int k = findPiece(document, where);
+	if (k >= document->count || document->pieces[k].start == where) return k;
+	struct Piece *piece = document->pieces + k;
+	long offset = where - piece->start;
+	if (!place(document, k+1, piece->data + offset, piece->length - offset)) return -1;
+	document->pieces[k].length = offset;
+	document->pieces[k].newlines = -1;
+	document->pieces[k+1].start = where;
+	return k+1;
+}
+
+static int place(doc_t *document, int at, const char *data, long length) {
+	if (document->count == document->capacity) {
+		int capacity = document->capacity ? document->capacity*2 : 64;
+		struct Piece *pieces = realloc(document->pieces, capacity * sizeof(struct Piece));
+		if (!pieces) return 0;
+		STAT(reallocs, 1);
+		document->pieces = pieces;
+		document->capacity = capacity;
+	}
+	STAT(moved, (document->count - at) * sizeof(struct Piece));
+	memmove(
+		document->pieces + at + 1, document->pieces + at,
+		(document->count - at) * sizeof(struct Piece)
+	);
+	document->pieces[at] = (struct Piece) {.data = data, .length = length, .newlines = -1};
+	document->count++;
+	return 1;
+}
+
+//reindex: linear in the pieces after from
+static void reindex(doc_t *document, int from) {
+	if (document->indexed > from) document->indexed = from;
+	long start = from > 0 ? document->pieces[from-1].start + document->pieces[from-1].length : 0;
+	for (int k = from; k < document->count; k++) {
+		document->pieces[k].start = start;
+		start += document->pieces[k].length;
+	}
+	if (document->hint >= document->count) document->hint = 0;
+}
+
+static void extendIndex(doc_t *document, int upto) {
+	for (int k = document->indexed; k <= upto && k < document->count; k++) {
+		struct Piece *piece = document->pieces + k;
+		if (piece->newlines < 0) piece->newlines = countNewlines(piece->data, piece->length);
+		piece->line = k > 0 ? piece[-1].line + piece[-1].newlines : 0;
+		document->indexed = k+1;
+	}
+}
+
+static void damage(doc_t *document, long where, long removed, long inserted) {
+	for (struct View *view = document->views; view; view = view->next) {
+		struct Damage *d = &view->damage;
+		if (!d->active) {
+			*d = (struct Damage) {where, where + inserted, inserted - removed, 1};
+			continue;
+		}
+		long to = d->to;
+		if (to >= where + removed) to += inserted - removed;
+		else if (to > where) to = where + inserted;
+		if (to < where + inserted) to = where + inserted;
+		if (d->from > where) d->from = where;
+		d->to = to;
+		d->delta += inserted - removed;
+	}
+}
+
+//moveViews: text inserted where a view's scroll is shows at its top
+static void moveViews(doc_t *document, long where, long removed, long inserted) {
+	for (struct View *view = document->views; view; view = view->next) {
+		long *positions[] = {&view->cursor, &view->selection, &view->scroll};
+		for (int k = 0; k < 3; k++) {
+			long *p = positions[k];
+			if (*p >= where + removed && (*p > where || k < 2)) *p += inserted - removed;
+			else if (*p > where) *p = where;
+		}
+	}
+}
+
+static long countNewlines(const char *data, long length) {
+	long newlines = 0;
+	const char *end = data + length;
+	while ((data = memchr(data, '\n', end - data))) {
+		newlines++;
+		data++;
+	}
+	return newlines;
+}
@@ -0,0 +1,191 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "layout.h"
+
+typedef struct Document doc_t;
+
+//text in the mapped file or an add block, newlines is -1 until counted and line is only valid
+//for the first indexed pieces, an edit costs O(pieces) as the pieces after it move
+struct Piece {
+	const char *data;
+	long length;
+	long start;
+	long newlines, line;
+};
+
+#define CHUNK_SIZE 65536
+
+//add blocks are append-only and never move, so pieces can point straight into them
+struct Block {
+	struct Block *next;
+	long used, size;
+	char data[];
+};
+
+//pieces can point into any file the text came from until the document is released
+struct Mapping {
+	struct Mapping *next;
+	char *data;
+	long length;
+	dev_t device;
+	ino_t inode;
+	int range;
+};
+
+//room in the table the SIGBUS handler looks mappings up in, another is read rather than mapped
+#define MAPPINGS 256
+
+//text after the damage has moved by delta and is otherwise untouched
+struct Damage {
+	long from, to, delta;
+	int active;
+};
+
+enum SaveState {SAVE_IDLE, SAVE_WRITING, SAVE_DONE, SAVE_FAILED};
+
+//written by another thread from a copy of the pieces, written and state are guarded by lock, target
+//is the file the path resolves to and file how it was, or the mode to create it with
+struct Save {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct Piece *pieces;
+	int count;
+	long written, length;
+	enum SaveState state;
+	bool again;
+	long position;
+	char *target;
+	struct stat file;
+	bool exists, inPlace;
+};
+
+//a file that couldn't be mapped, such as a pipe, read into blocks by a thread, the chain and
+//finished are guarded by lock
+struct Load {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int fd;
+	struct Block *first, *last;
+	long taken;
+	bool active, finished;
+};
+
+#define JOURNAL_LIMIT (4L<<20)
+
+//position changes whenever the text the edit leaves changes, as when a typed edit grows
+struct Edit {
+	long where, length;
+	int first, count;
+	bool inserted, typed;
+	long step, position;
+};
+
+//base is the position before the first edit, positions are never reused, bytes is how much of the
+//add blocks the pieces hold on to and dropped how much forgotten edits did since blocks were freed
+struct Journal {
+	struct Edit *edits;
+	int count, capacity, done;
+	struct Piece *arena;
+	int used, size;
+	long step, positions, base;
+	bool joining;
+	long limit, bytes, dropped;
+};
+
+#define FOLLOW_BATCH (4L<<20)
+
+//fd stays open so a log is read to its end once it's rotated away
+struct Follow {
+	int fd;
+	long read, limit, dropped;
+	bool active, truncated;
+};
+
+//cut is set once the file was cut short under its mapping, file is the file as the text last
+//matched it, synced the position in the journal then and tail a copy of its end, as the mapping
+//would show a rewrite of the file too
+struct Document {
+	char *path;
+	struct Mapping *mappings;
+	struct Block *blocks;
+	struct Piece *pieces;
+	int count, capacity, hint;
+	int indexed;
+	long length;
+	struct View *views;
+	struct Save saving;
+	struct Load loading;
+	struct Journal journal;
+	struct Follow following;
+	struct stat file;
+	long synced;
+	char tail[4096];
+	int tailLength;
+	bool cut;
+};
+
+enum Refresh {REFRESH_NONE, REFRESH_APPENDED, REFRESH_SPLICED, REFRESH_RELOAD, REFRESH_EDITED, REFRESH_LATER};
+
+//the start of each row drawn, -1 past the end, and what else the frame was drawn with
+struct Frame {
+	long *rows;
+	int count, offset;
+	long cursor, selection, matches;
+	bool prompt, overlay;
+};
+
+struct View {
+	doc_t *document;
+	long scroll, cursor, selection;
+	struct Layout layout;
+	struct Damage damage;
+	uint32_t window;
+	int width, height;
+	int scrollOffset;
+	struct Frame shown;
+	struct View *next;
+};
+
+doc_t *load(doc_t *document, char *path);
+void unload(doc_t *document);
+enum Refresh refresh(doc_t *document);
+void reload(doc_t *document);
+bool startFollowing(doc_t *document, long limit);
+void stopFollowing(doc_t *document);
+bool followMore(doc_t *document);
+bool trim(doc_t *document);
+void addView(doc_t *document, struct View *view);
+void removeView(struct View *view);
+bool reclaimable(doc_t *document);
+void reclaim(doc_t *document);
+bool save(doc_t *document);
+bool cutShort(doc_t *document);
+bool savesInPlace(doc_t *document);
+enum SaveState saveProgress(doc_t *document, long *written, long *length);
+void waitForSave(doc_t *document);
+bool loadMore(doc_t *document);
+
+char charAt(doc_t *document, long i);
+void copyOut(doc_t *document, long from, long to, char *out);
+struct Piece *snapshot(doc_t *document, long from, long to, int *count);
+
+long lineOf(doc_t *document, long i);
+long lineStart(doc_t *document, long line);
+
+long undamaged(struct View *view, long i);
+
+void doInsertAction(doc_t *document, long where, long length, char *data);
+void doDeleteAction(doc_t *document, long from, long to);
+const char *stash(doc_t *document, const char *data, long length);
+void replacePieces(doc_t *document, struct Piece *pieces, int count, long length);
+void joinEdits(doc_t *document);
+long undo(doc_t *document);
+long redo(doc_t *document);
+
+#endif
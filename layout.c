@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "layout.h"
+#include "stats.h"
+
+uint16_t advanceLookupTable[95];
+
+static int findWrap(struct Layout *layout, long i);
+static int findCheckpoint(struct Layout *layout, long i);
+static void addCheckpoint(struct Layout *layout, long i);
+static void editLayout(struct Layout *layout, long where, long removed, long inserted, long next);
+static void measure(struct View *view, struct Wrap *wrap);
+static void dropWraps(struct Layout *layout, int from, int to);
+
+int advance(char c) {
+	STAT(advances, 1);
+	if (c == '\t') {
+		return 24;
+	} else if (c >= 0x20 && c < 0x7F) {
+		return advanceLookupTable[c-0x20];
+	} else {
+		return advanceLookupTable[hexdigit(c)-0x20]
+			+ advanceLookupTable[hexdigit(((unsigned char)c)<<4)-0x20]
+			+ advanceLookupTable['['-0x20] + advanceLookupTable[']'-0x20];
+	}
+}
+
+void setLayoutWidth(struct Layout *layout, int width) {
+	if (layout->width != width) clearLayout(layout);
+	layout->width = width;
+}
+
+void clearLayout(struct Layout *layout) {
+	dropWraps(layout, 0, layout->count);
+	layout->checkpointCount = 0;
+}
+
+void freeLayout(struct Layout *layout) {
+	clearLayout(layout);
+	free(layout->wraps);
+	free(layout->checkpoints);
+	*layout = (struct Layout) {0};
+}
+
+//layoutEdit: the rows after an edit may break differently, so the layout is dropped up to the end of the lines it touched
+void layoutEdit(doc_t *document, long where, long removed, long inserted) {
+	if (!document->views) return;
+	long next = lineStart(document, lineOf(document, where + inserted) + 1);
+	for (struct View *view = document->views; view; view = view->next) {
+		editLayout(&view->layout, where, removed, inserted, next);
+	}
+}
+
+static void editLayout(struct Layout *layout, long where, long removed, long inserted, long next) {
+	long delta = inserted - removed;
+	int kept = 0;
+	for (int k = 0; k < layout->count; k++) {
+		struct Wrap *wrap = layout->wraps + k;
+		if (wrap->end >= where && wrap->start <= where + removed) {
+			free(wrap->breaks);
+			continue;
+		}
+		if (wrap->start > where + removed) {
+			wrap->start += delta;
+			wrap->end += delta;
+			for (int r = 0; r < wrap->rows-1; r++) wrap->breaks[r] += delta;
+			if (wrap->start < next) {
+				free(wrap->breaks);
+				continue;
+			}
+		}
+		layout->wraps[kept++] = *wrap;
+	}
+	layout->count = kept;
+	kept = 0;
+	for (int k = 0; k < layout->checkpointCount; k++) {
+		long checkpoint = layout->checkpoints[k];
+		if (checkpoint > where + removed) checkpoint += delta;
+		else if (checkpoint >= where) continue;
+		if (checkpoint >= where && checkpoint < next) continue;
+		layout->checkpoints[kept++] = checkpoint;
+	}
+	layout->checkpointCount = kept;
+}
+
+//wrapOf: the result is only valid until the next call as the cache may be rearranged
+struct Wrap *wrapOf(struct View *view, long i) {
+	doc_t *document = view->document;
+	struct Layout *layout = &view->layout;
+	if (i > document->length) i = document->length;
+	int k = findWrap(layout, i);
+	if (k >= 0 && (i < layout->wraps[k].end || (i == layout->wraps[k].end && layout->wraps[k].final))) {
+		return layout->wraps + k;
+	}
+	struct Wrap measured = {.start = lineStart(document, lineOf(document, i))};
+	int c = findCheckpoint(layout, i);
+	if (c >= 0 && layout->checkpoints[c] > measured.start) measured.start = layout->checkpoints[c];
+	for (;;) {
+		measure(view, &measured);
+		if (i < measured.end || measured.final) break;
+		addCheckpoint(layout, measured.end);
+		free(measured.breaks);
+		measured = (struct Wrap) {.start = measured.end};
+	}
+	if (!layout->wraps) {
+		layout->wraps = malloc(LAYOUT_CACHE * sizeof(struct Wrap));
+		if (!layout->wraps) {
+			free(measured.breaks);
+			return NULL;
+		}
+	}
+	if (layout->count == LAYOUT_CACHE) {
+		int farthest = labs(layout->wraps[0].start - i) > labs(layout->wraps[layout->count-1].start - i)
+			? 0 : layout->count-1;
+		dropWraps(layout, farthest, farthest+1);
+		k = findWrap(layout, i);
+	}
+	k++;
+	memmove(layout->wraps + k+1, layout->wraps + k, (layout->count - k) * sizeof(struct Wrap));
+	layout->count++;
+	layout->wraps[k] = measured;
+	return layout->wraps + k;
+}
+
+//rowOf: a position at a break starts the next row
+int rowOf(struct Wrap *wrap, long i) {
+	int low = 0, high = wrap->rows-1;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (wrap->breaks[middle] <= i) low = middle + 1;
+		else high = middle;
+	}
+	return low;
+}
+
+long rowStart(struct Wrap *wrap, int row) {
+	return row > 0 ? wrap->breaks[row-1] : wrap->start;
+}
+
+long rowEnd(struct Wrap *wrap, int row) {
+	return row < wrap->rows-1 ? wrap->breaks[row] : wrap->end;
+}
+
+long startOfRow(struct View *view, long i) {
+	struct Wrap *wrap = wrapOf(view, i);
+	return wrap ? rowStart(wrap, rowOf(wrap, i)) : i;
+}
+
+long endOfRow(struct View *view, long i) {
+	struct Wrap *wrap = wrapOf(view, i);
+	return wrap ? rowEnd(wrap, rowOf(wrap, i)) : i;
+}
+
+long nextRow(struct View *view, long i) {
+	struct Wrap *wrap = wrapOf(view, i);
+	if (!wrap) return -1;
+	int row = rowOf(wrap, i);
+	if (row < wrap->rows-1) return wrap->breaks[row];
+	if (!wrap->final) return wrap->end;
+	if (wrap->end < view->document->length) return wrap->end + 1;
+	return -1;
+}
+
+long previousRow(struct View *view, long i) {
+	struct Wrap *wrap = wrapOf(view, i);
+	if (!wrap) return -1;
+	int row = rowOf(wrap, i);
+	if (row > 0) return rowStart(wrap, row-1);
+	if (wrap->start == 0) return -1;
+	wrap = wrapOf(view, wrap->start - 1);
+	return wrap ? rowStart(wrap, wrap->rows-1) : -1;
+}
+
+static int findWrap(struct Layout *layout, long i) {
+	int low = -1, high = layout->count-1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (layout->wraps[middle].start <= i) low = middle;
+		else high = middle - 1;
+	}
+	return low;
+}
+
+static int findCheckpoint(struct Layout *layout, long i) {
+	int low = -1, high = layout->checkpointCount-1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (layout->checkpoints[middle] <= i) low = middle;
+		else high = middle - 1;
+	}
+	return low;
+}
+
+static void addCheckpoint(struct Layout *layout, long i) {
+	int k = findCheckpoint(layout, i);
+	if (k >= 0 && layout->checkpoints[k] == i) return;
+	if (layout->checkpointCount == layout->checkpointCapacity) {
+		int capacity = layout->checkpointCapacity ? layout->checkpointCapacity*2 : 64;
+		long *checkpoints = realloc(layout->checkpoints, capacity * sizeof(long));
+		if (!checkpoints) return;
+		layout->checkpoints = checkpoints;
+		layout->checkpointCapacity = capacity;
+	}
+	k++;
+	memmove(layout->checkpoints + k+1, layout->checkpoints + k, (layout->checkpointCount - k) * sizeof(long));
+	layout->checkpoints[k] = i;
+	layout->checkpointCount++;
+}
+
+//measure: a row always gets at least one character so it can't stall
+static void measure(struct View *view, struct Wrap *wrap) {
+	doc_t *document = view->document;
+	int capacity = 0, x = 0;
+	long i = wrap->start;
+	wrap->rows = 1;
+	wrap->breaks = NULL;
+	char c;
+	while (i < document->length && (c = charAt(document, i)) != '\n') {
+		if (x > 0 && x + advance(c) >= view->layout.width) {
+			if (i - wrap->start >= CHECKPOINT_INTERVAL) {
+				wrap->end = i;
+				wrap->final = 0;
+				return;
+			}
+			if (wrap->rows > capacity) {
+				long *breaks = realloc(wrap->breaks, (capacity ? capacity*2 : 8) * sizeof(long));
+				if (breaks) {
+					wrap->breaks = breaks;
+					capacity = capacity ? capacity*2 : 8;
+				}
+			}
+			if (wrap->rows <= capacity) wrap->breaks[wrap->rows++ - 1] = i;
+			x = 0;
+		}
+		x += advance(c);
+		i++;
+	}
+	wrap->end = i;
+	wrap->final = 1;
+}
+
+static void dropWraps(struct Layout *layout, int from, int to) {
+	if (from == to) return;
+	for (int k = from; k < to; k++) free(layout->wraps[k].breaks);
+	memmove(layout->wraps + from, layout->wraps + to, (layout->count - to) * sizeof(struct Wrap));
+	layout->count -= to - from;
+}
@@ -0,0 +1,50 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdint.h>
+
+struct Document;
+struct View;
+
+//a final wrap ends at the newline or the end of the document, otherwise end is a checkpoint
+//where the next wrap of the same line starts, so long lines are measured a piece at a time
+struct Wrap {
+	long start, end;
+	int rows;
+	int final;
+	long *breaks;
+};
+
+struct Layout {
+	int width;
+	struct Wrap *wraps;
+	int count;
+	long *checkpoints;
+	int checkpointCount, checkpointCapacity;
+};
+
+#define LAYOUT_CACHE 512
+#define CHECKPOINT_INTERVAL 16384
+
+extern uint16_t advanceLookupTable[95];
+// advanceLookupTable starts from 0x20 'space'
+
+static inline char hexdigit(unsigned char c) {return (c&0xf)>=10 ? (c&0xf)-10+'a' : (c&0xf)+'0';}
+int advance(char c);
+
+void setLayoutWidth(struct Layout *layout, int width);
+void clearLayout(struct Layout *layout);
+void freeLayout(struct Layout *layout);
+void layoutEdit(struct Document *document, long where, long removed, long inserted);
+
+struct Wrap *wrapOf(struct View *view, long i);
+int rowOf(struct Wrap *wrap, long i);
+long rowStart(struct Wrap *wrap, int row);
+long rowEnd(struct Wrap *wrap, int row);
+
+long startOfRow(struct View *view, long i);
+long endOfRow(struct View *view, long i);
+long nextRow(struct View *view, long i);
+long previousRow(struct View *view, long i);
+
+#endif
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "render.h"
+#include "search.h"
+#include "stats.h"
+
+struct Backend backend;
+
+long nullCalls, nullCharacters;
+
+uint16_t lineoffset = 0;
+uint16_t lineheight = 0;
+
+uint32_t bg, fg;
+
+#ifdef STATS
+bool showStats = false;
+#endif
+
+static int findShift(struct View *view, long *rows, int count);
+static bool rowChanged(
+	struct View *view, int k, int shift, long *rows, long cur, long sel, bool prompting, bool overlaid
+);
+static void paintRow(struct View *view, int k, long *rows, long cur, long sel);
+static void drawRow(doc_t *document, long from, long to, int y, long cur, long sel);
+static void drawPrompt(struct View *view, struct Prompt *prompt);
+static void drawCursor(int x, int y);
+#ifdef STATS
+static void drawStats(struct View *view);
+#endif
+static void present(struct View *view, int y, int height);
+
+static bool nullUse(uint32_t window);
+static void nullForget(uint32_t window);
+static bool nullResize(int width, int height);
+static void nullFill(int x, int y, int width, int height, uint32_t color);
+static int nullText(const char *s, int length, int x, int y, uint32_t color);
+static void nullShift(int dy);
+static void nullPresent(int y, int height);
+
+struct Backend nullBackend = {nullUse, nullForget, nullResize, nullFill, nullText, nullShift, nullPresent};
+
+bool resizeCanvas(struct View *view, int width, int height) {
+	view->width = width;
+	view->height = height;
+	setLayoutWidth(&view->layout, width);
+	free(view->shown.rows);
+	view->shown.rows = malloc((height / lineheight + 3) * sizeof(long));
+	view->shown.count = 0;
+	return view->shown.rows && backend.use(view->window) && backend.resize(width, height);
+}
+
+void forgetCanvas(struct View *view) {
+	backend.forget(view->window);
+	free(view->shown.rows);
+	view->shown.rows = NULL;
+	view->shown.count = 0;
+}
+
+//draw: only rows that changed are rendered, after shifting the old ones within the canvas when the view scrolled
+void draw(struct View *view, struct Prompt *prompt) {
+	struct Frame *shown = &view->shown;
+	int scrollOffset = view->scrollOffset, height = view->height;
+	long cur = view->cursor, sel = view->selection;
+	if (cur > sel) {long _t = sel; sel = cur; cur = _t;}
+	bool prompting = prompt && prompt->action;
+	#ifdef STATS
+	stats_frameStart();
+	bool overlaid = showStats;
+	#else
+	bool overlaid = false;
+	#endif
+	
+	backend.use(view->window);
+	int count = (height + scrollOffset + lineheight - 1) / lineheight;
+	long rows[count+1];
+	rows[0] = view->scroll = startOfRow(view, view->scroll);
+	for (int k = 0; k < count; k++) rows[k+1] = rows[k] >= 0 ? nextRow(view, rows[k]) : -1;
+	
+	int shift = findShift(view, rows, count);
+	int dy = shift*lineheight + scrollOffset - shown->offset;
+	bool moved = shift < shown->count && dy != 0;
+	if (moved && abs(dy) < height) backend.shift(dy);
+	
+	int from = -1;
+	for (int k = 0; k <= count; k++) {
+		if (k < count && rowChanged(view, k, shift, rows, cur, sel, prompting, overlaid)) {
+			paintRow(view, k, rows, cur, sel);
+			if (from < 0) from = k;
+		} else if (from >= 0) {
+			if (!moved) present(view, from*lineheight - scrollOffset, (k-from)*lineheight);
+			from = -1;
+		}
+	}
+	if (prompting) {
+		drawPrompt(view, prompt);
+		if (!moved) present(view, height - lineheight, lineheight);
+	}
+	#ifdef STATS
+	//the overlay is drawn after the frame is measured, so what it costs is put on the next one
+	stats_frameEnd();
+	if (overlaid) {
+		drawStats(view);
+		if (!moved) present(view, 0, lineheight);
+	}
+	#endif
+	if (moved) present(view, 0, height);
+	
+	memcpy(shown->rows, rows, sizeof(rows));
+	shown->count = count;
+	shown->offset = scrollOffset;
+	shown->cursor = cur;
+	shown->selection = sel;
+	shown->matches = search_version(view->document);
+	shown->prompt = prompting;
+	shown->overlay = overlaid;
+	view->damage.active = 0;
+}
+
+bool showCanvas(struct View *view, int y, int height) {
+	if (!view->shown.count) return false;
+	backend.use(view->window);
+	present(view, y, height);
+	return true;
+}
+
+int textWidth(const char *s, int length) {
+	int width = 0;
+	for (int i = 0; i < length; i++) width += advance(s[i]);
+	return width;
+}
+
+double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+long findPositionIn(struct View *view, int mx, int y) {
+	long row = view->scroll;
+	y += view->scrollOffset;
+	for (; y >= lineheight; y -= lineheight) {
+		row = nextRow(view, row);
+		if (row < 0) return view->document->length;
+	}
+	return y < 0 ? row : positionInRow(view, row, mx);
+}
+
+int isPositionOutsideBounds(struct View *view, long p) {
+	if (p < view->scroll) return 1;
+	long row = view->scroll;
+	for (int y = -view->scrollOffset; y < view->height; y += lineheight) {
+		row = nextRow(view, row);
+		if (row < 0 || p < row) return 0;
+	}
+	return 1;
+}
+
+//positionInRow: stays before a wrap so the cursor stays on the row
+long positionInRow(struct View *view, long row, int w) {
+	doc_t *document = view->document;
+	long end = endOfRow(view, row);
+	if (end < document->length && charAt(document, end) != '\n' && end > row) end--;
+	int x = 0;
+	long i = row;
+	while (i < end && x + advance(charAt(document, i)) <= w) x += advance(charAt(document, i++));
+	return i;
+}
+
+static int findShift(struct View *view, long *rows, int count) {
+	struct Frame *shown = &view->shown;
+	for (int k = 0; k < shown->count && k < count; k++) {
+		if (undamaged(view, shown->rows[k]) == rows[0]) return k;
+		if (rows[k] >= 0 && rows[k] == undamaged(view, shown->rows[0])) return -k;
+	}
+	return shown->count;
+}
+
+//rowChanged: a row is unchanged if its text only moved and the old row showed at least as much of it
+static bool rowChanged(
+	struct View *view, int k, int shift, long *rows, long cur, long sel, bool prompting, bool overlaid
+) {
+	doc_t *document = view->document;
+	struct Frame *shown = &view->shown;
+	int height = view->height;
+	int j = k + shift;
+	if (j < 0 || j >= shown->count) return true;
+	int was = j*lineheight - shown->offset, is = k*lineheight - view->scrollOffset;
+	if (is < 0 ? was < is : was < 0) return true;
+	if (is + lineheight > height ? was > is : was + lineheight > height) return true;
+	if (prompting && is + lineheight > height - lineheight) return true;
+	if (shown->prompt && was + lineheight > height - lineheight) return true;
+	if (overlaid && is < lineheight) return true;
+	if (shown->overlay && was < lineheight) return true;
+	if (shown->matches != search_version(document)) return true;
+	if (undamaged(view, shown->rows[j]) != rows[k]) return true;
+	if (undamaged(view, shown->rows[j+1]) != rows[k+1]) return true;
+	if (rows[k] < 0) return false;
+	
+	long a = rows[k], b = rows[k+1] >= 0 ? rows[k+1] : document->length;
+	struct Damage *d = &view->damage;
+	if (d->active && d->from <= b && d->to >= a) return true;
+	long oldCur = undamaged(view, shown->cursor), oldSel = undamaged(view, shown->selection);
+	if (oldCur != cur && (oldCur < cur ? oldCur : cur) <= b && (oldCur > cur ? oldCur : cur) >= a) return true;
+	if (oldSel != sel && (oldSel < sel ? oldSel : sel) <= b && (oldSel > sel ? oldSel : sel) >= a) return true;
+	return false;
+}
+
+static void paintRow(struct View *view, int k, long *rows, long cur, long sel) {
+	doc_t *document = view->document;
+	int y = k*lineheight - view->scrollOffset;
+	backend.fill(0, y, view->width, lineheight, bg);
+	if (rows[k] >= 0) drawRow(document, rows[k], endOfRow(view, rows[k]), y, cur, sel);
+}
+
+//drawRow: a newline ending the row is drawn as a space so that it shows up when selected
+static void drawRow(doc_t *document, long from, long to, int y, long cur, long sel) {
+	char buffer[256];
+	bool newline = to < document->length && charAt(document, to) == '\n';
+	long stop = newline ? to+1 : to;
+	int x = 0;
+	for (long i = from; i < stop;) {
+		long next = stop - i > (long) sizeof(buffer) ? i + (long) sizeof(buffer) : stop;
+		if (i < cur && cur < next) next = cur;
+		if (i < sel && sel < next) next = sel;
+		long edge;
+		bool matched = search_highlighted(document, i, &edge);
+		if (edge < next) next = edge;
+		int length = next - i;
+		copyOut(document, i, next, buffer);
+		if (next == to+1) buffer[length-1] = ' ';
+	
+		int width = textWidth(buffer, length);
+		bool selected = i >= cur && i < sel;
+		if (selected) backend.fill(x, y, width, lineheight, fg);
+		if (matched) backend.fill(x, y + lineheight-2, width, 2, selected ? bg : fg);
+		if (i == cur && cur == sel) drawCursor(x, y);
+		backend.text(buffer, length, x, lineoffset+y, selected ? bg : fg);
+		x += width;
+		i = next;
+	}
+	if (cur == sel && cur == stop && to == document->length) drawCursor(x, y);
+}
+
+static void drawPrompt(struct View *view, struct Prompt *prompt) {
+	int y = view->height - lineheight;
+	int width = textWidth(prompt->label, strlen(prompt->label));
+	backend.fill(0, y, view->width, lineheight, bg);
+	backend.fill(0, y, width, lineheight, fg);
+	backend.text(prompt->label, strlen(prompt->label), 0, lineoffset+y, bg);
+	backend.text(prompt->text, prompt->length, width, lineoffset+y, fg);
+	drawCursor(width + textWidth(prompt->text, prompt->length), y);
+}
+
+static void drawCursor(int x, int y) {
+	backend.fill(x, y, 1, lineheight+1, fg);
+}
+
+#ifdef STATS
+static void drawStats(struct View *view) {
+	char text[256];
+	int length = stats_format(text, sizeof(text));
+	backend.fill(0, 0, view->width, lineheight, fg);
+	backend.text(text, length, 0, lineoffset, bg);
+}
+#endif
+
+static void present(struct View *view, int y, int height) {
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if (y + height > view->height) height = view->height - y;
+	if (height > 0) backend.present(y, height);
+}
+
+static bool nullUse(uint32_t window) {
+	(void) window;
+	return true;
+}
+
+static void nullForget(uint32_t window) {
+	(void) window;
+}
+
+static bool nullResize(int width, int height) {
+	(void) width;
+	(void) height;
+	nullCalls++;
+	return true;
+}
+
+static void nullFill(int x, int y, int width, int height, uint32_t color) {
+	(void) x;
+	(void) y;
+	(void) width;
+	(void) height;
+	(void) color;
+	nullCalls++;
+}
+
+static int nullText(const char *s, int length, int x, int y, uint32_t color) {
+	(void) x;
+	(void) y;
+	(void) color;
+	nullCalls++;
+	nullCharacters += length;
+	return textWidth(s, length);
+}
+
+static void nullShift(int dy) {
+	(void) dy;
+	nullCalls++;
+}
+
+static void nullPresent(int y, int height) {
+	(void) y;
+	(void) height;
+	nullCalls++;
+}
@@ -0,0 +1,53 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "document.h"
+
+//text is drawn from its baseline and returns its width, shift moves the canvas up by dy pixels
+struct Backend {
+	bool (*use)(uint32_t window);
+	void (*forget)(uint32_t window);
+	bool (*resize)(int width, int height);
+	void (*fill)(int x, int y, int width, int height, uint32_t color);
+	int (*text)(const char *s, int length, int x, int y, uint32_t color);
+	void (*shift)(int dy);
+	void (*present)(int y, int height);
+};
+
+#define PROMPT_LENGTH 256
+
+//changed is told about the text as it's typed if it's set, and about "" on escape
+struct Prompt {
+	char *label;
+	char text[PROMPT_LENGTH];
+	int length;
+	void (*action)(struct View *, char *);
+	void (*changed)(struct View *, char *);
+};
+
+//draws nothing, only counting the calls and characters, for running without a display
+extern struct Backend nullBackend;
+extern long nullCalls, nullCharacters;
+
+extern struct Backend backend;
+extern uint16_t lineoffset, lineheight;
+extern uint32_t bg, fg;
+#ifdef STATS
+extern bool showStats;
+#endif
+
+bool resizeCanvas(struct View *view, int width, int height);
+void draw(struct View *view, struct Prompt *prompt);
+bool showCanvas(struct View *view, int y, int height);
+void forgetCanvas(struct View *view);
+int textWidth(const char *s, int length);
+double now();
+
+long findPositionIn(struct View *view, int mx, int y);
+int isPositionOutsideBounds(struct View *view, long p);
+long positionInRow(struct View *view, long row, int w);
+
+#endif
@@ -0,0 +1,633 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <pthread.h>
+#include <regex.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "search.h"
+
+//search: matches are counted by threads over a snapshot of the pieces, whose text stays put
+//until the document is released, so searching is stopped before a reload
+
+//shorter gaps between matches are copied along with the replacements, to keep the pieces few
+#define REPLACE_COPY 256
+
+//finished is guarded by the lock, ready is the main thread's copy of it
+struct Slice {
+	pthread_t thread;
+	bool started;
+	int first, stop;
+	long from, to;
+	long *matches;
+	long count, kept, capacity, limit, last;
+	bool finished, ready;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	bool cancelled;
+	doc_t *document;
+	struct Piece *pieces;
+	int count;
+	char *needle;
+	int length;
+	struct Slice slices[SEARCH_THREADS];
+	int threads;
+	bool running;
+	long version;
+} search = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+struct Rebuild {
+	doc_t *document;
+	struct Piece *pieces;
+	int count, capacity;
+	long length, copied;
+	int k;
+	long *positions, *moved;
+	bool *followed;
+	int tracked;
+	long matches;
+	bool failed;
+};
+
+#ifdef __SSE2__
+//found before any searching so the threads only read it
+static pthread_once_t probed = PTHREAD_ONCE_INIT;
+static bool avx2;
+#endif
+
+static void *countSlice(void *argument);
+static bool keep(struct Slice *slice, long where);
+static void settle(struct Slice *slice, long end);
+static bool find(struct Piece *pieces, int count, int *k, long *i, int stop, const char *needle, int n);
+static bool matchAt(struct Piece *pieces, int count, int k, long i, const char *needle, int n);
+static void pass(struct Piece *pieces, int count, int *k, long *i, int n);
+static long candidate(const char *data, long length, const char *needle, int n);
+#ifdef __SSE2__
+static void probe();
+static long scanSSE2(const char *data, long length, const char *needle, int n);
+static long scanAVX2(const char *data, long length, const char *needle, int n);
+#endif
+static void replaceLiteral(struct Rebuild *r, const char *needle, int n, const char *replacement);
+static void replaceRegex(struct Rebuild *r, regex_t *pattern, const char *replacement);
+static bool matchFrom(regex_t *pattern, const char *line, long at, long length, regmatch_t *groups);
+static long expand(const char *replacement, const char *line, regmatch_t *groups, char **out, long *size);
+static void replaced(struct Rebuild *r, long from, long to, const char *text, long length);
+static bool track(struct Rebuild *r);
+static void follow(struct Rebuild *r, long from, long to);
+static void copyTo(struct Rebuild *r, long to);
+static void emit(struct Rebuild *r, const char *data, long length);
+static long findIn(doc_t *document, const char *needle, int length, long from, long to);
+static int pieceAt(doc_t *document, long where);
+static long lastMatch(struct Slice *slice, long i);
+
+//search_next: looks at no more than limit bytes from from, going around past the end
+long search_next(doc_t *document, const char *needle, int length, long from, long limit) {
+	if (length <= 0 || !document->count) return -1;
+	#ifdef __SSE2__
+	pthread_once(&probed, probe);
+	#endif
+	if (from < 0 || from > document->length) from = 0;
+	if (limit > document->length) limit = document->length;
+	long found = findIn(document, needle, length, from, from + limit);
+	if (found < 0 && from + limit > document->length) {
+		found = findIn(document, needle, length, 0, from + limit - document->length);
+	}
+	return found;
+}
+
+//search_first: the first match the count found from from on, going around past the end, or
+//SEARCH_UNKNOWN while the slices it would be in aren't done
+long search_first(doc_t *document, long from) {
+	if (document != search.document || !search.threads) return -1;
+	int first = 0;
+	while (first < search.threads-1 && from >= search.slices[first].to) first++;
+	for (int n = 0; n <= search.threads; n++) {
+		struct Slice *slice = search.slices + (first + n) % search.threads;
+		if (!slice->ready) return SEARCH_UNKNOWN;
+		long least = n ? slice->from : from;
+		long m = lastMatch(slice, least-1) + 1;
+		if (m < slice->kept) return slice->matches[m];
+		//only the first matches of a slice are kept, the rest are found again
+		if (slice->kept < slice->count) {
+			long after = least;
+			long end = slice->kept ? slice->matches[slice->kept-1] + search.length : 0;
+			if (end > after) after = end;
+			long found = findIn(document, search.needle, search.length, after, slice->to);
+			if (found >= 0) return found;
+		}
+	}
+	return -1;
+}
+
+//search_replace: -1 if the pattern is bad, memory ran out, or a line holds a NUL where regexec
+//can't be told where lines end
+long search_replace(doc_t *document, const char *pattern, const char *replacement, bool regex) {
+	struct Rebuild r = {.document = document};
+	if (!track(&r)) return -1;
+	if (regex) {
+		regex_t compiled;
+		if (regcomp(&compiled, pattern, REG_EXTENDED)) r.failed = true;
+		else {
+			replaceRegex(&r, &compiled, replacement);
+			regfree(&compiled);
+		}
+	} else {
+		if (!*pattern) r.failed = true;
+		else replaceLiteral(&r, pattern, strlen(pattern), replacement);
+	}
+	if (r.matches && !r.failed) {
+		follow(&r, document->length + 1, document->length + 1);
+		copyTo(&r, document->length);
+	}
+	if (!r.matches || r.failed) {
+		free(r.pieces);
+		free(r.positions);
+		return r.failed ? -1 : 0;
+	}
+	replacePieces(document, r.pieces, r.count, r.length);
+	long *moved = r.moved;
+	for (struct View *view = document->views; view; view = view->next) {
+		view->cursor = *moved++;
+		view->selection = *moved++;
+		view->scroll = startOfRow(view, *moved++);
+	}
+	free(r.positions);
+	return r.matches;
+}
+
+void search_start(doc_t *document, const char *needle, int length) {
+	search_stop();
+	if (length <= 0) return;
+	#ifdef __SSE2__
+	pthread_once(&probed, probe);
+	#endif
+	search.needle = malloc(length);
+	if (!search.needle) return;
+	memcpy(search.needle, needle, length);
+	search.length = length;
+	search.document = document;
+	search.pieces = snapshot(document, 0, document->length, &search.count);
+	search.version++;
+	if (!search.pieces) return;
+	
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	long threads = document->length / SEARCH_SLICE + 1;
+	if (threads > cores) threads = cores > 0 ? cores : 1;
+	if (threads > SEARCH_THREADS) threads = SEARCH_THREADS;
+	search.running = true;
+	int k = 0;
+	for (int s = 0; s < threads && k < search.count; s++) {
+		struct Slice *slice = search.slices + search.threads++;
+		long to = s == threads-1 ? document->length : document->length * (s+1) / threads;
+		*slice = (struct Slice) {
+			.first = k, .from = search.pieces[k].start, .limit = SEARCH_HIGHLIGHTS / threads, .last = -1
+		};
+		while (k < search.count && search.pieces[k].start < to) k++;
+		slice->stop = k;
+		slice->to = k < search.count ? search.pieces[k].start : document->length;
+		slice->started = !pthread_create(&slice->thread, NULL, countSlice, slice);
+		if (!slice->started) countSlice(slice);
+	}
+}
+
+void search_stop() {
+	if (!search.needle) return;
+	pthread_mutex_lock(&search.lock);
+	search.cancelled = true;
+	pthread_mutex_unlock(&search.lock);
+	for (int s = 0; s < search.threads; s++) {
+		struct Slice *slice = search.slices + s;
+		if (slice->started) pthread_join(slice->thread, NULL);
+		free(slice->matches);
+	}
+	free(search.pieces);
+	free(search.needle);
+	search.document = NULL;
+	search.pieces = NULL;
+	search.needle = NULL;
+	search.count = search.length = search.threads = 0;
+	search.cancelled = search.running = false;
+	search.version++;
+}
+
+//search_poll: slices are taken in order, as a match at the end of one can overlap the next
+bool search_poll(long *count) {
+	bool running = false;
+	long end = 0;
+	*count = 0;
+	for (int s = 0; s < search.threads; s++) {
+		struct Slice *slice = search.slices + s;
+		if (!slice->ready && !running) {
+			pthread_mutex_lock(&search.lock);
+			bool finished = slice->finished;
+			pthread_mutex_unlock(&search.lock);
+			if (finished) {
+				settle(slice, end);
+				slice->ready = true;
+				search.version++;
+			}
+		}
+		running |= !slice->ready;
+		if (!slice->ready) continue;
+		*count += slice->count;
+		if (slice->last >= 0) end = slice->last + search.length;
+	}
+	if (search.running && !running) {
+		for (int s = 0; s < search.threads; s++) {
+			if (search.slices[s].started) pthread_join(search.slices[s].thread, NULL);
+			search.slices[s].started = false;
+		}
+		free(search.pieces);
+		search.pieces = NULL;
+		search.running = false;
+	}
+	return running;
+}
+
+long search_version(doc_t *document) {
+	return document == search.document ? search.version : 0;
+}
+
+bool search_highlighted(doc_t *document, long i, long *next) {
+	if (document != search.document) {
+		*next = LONG_MAX;
+		return false;
+	}
+	int s = 0;
+	while (s < search.threads && i >= search.slices[s].to) s++;
+	*next = LONG_MAX;
+	if (s == search.threads) return false;
+	struct Slice *slice = search.slices + s;
+	long m = slice->ready ? lastMatch(slice, i) : -1;
+	long start = m >= 0 ? slice->matches[m] : -1;
+	if (m < 0 && s > 0 && search.slices[s-1].ready && search.slices[s-1].kept) {
+		start = search.slices[s-1].matches[search.slices[s-1].kept-1];
+	}
+	if (start >= 0 && start + search.length > i) {
+		*next = start + search.length;
+		return true;
+	}
+	*next = slice->ready && m+1 < slice->kept ? slice->matches[m+1] : slice->to;
+	return false;
+}
+
+//countSlice: matches don't overlap, so that they're the ones replaced
+static void *countSlice(void *argument) {
+	struct Slice *slice = argument;
+	int j = slice->first;
+	long i = 0;
+	for (int k = slice->first; k < slice->stop; k++) {
+		pthread_mutex_lock(&search.lock);
+		bool cancelled = search.cancelled;
+		pthread_mutex_unlock(&search.lock);
+		if (cancelled) break;
+		while (j == k && find(search.pieces, search.count, &j, &i, k+1, search.needle, search.length)) {
+			slice->count++;
+			slice->last = search.pieces[j].start + i;
+			keep(slice, slice->last);
+			pass(search.pieces, search.count, &j, &i, search.length);
+		}
+	}
+	pthread_mutex_lock(&search.lock);
+	slice->finished = true;
+	pthread_mutex_unlock(&search.lock);
+	return NULL;
+}
+
+static bool keep(struct Slice *slice, long where) {
+	if (slice->kept >= slice->limit) return false;
+	if (slice->kept == slice->capacity) {
+		long capacity = slice->capacity ? slice->capacity*2 : 256;
+		long *matches = realloc(slice->matches, capacity * sizeof(long));
+		if (!matches) return false;
+		slice->matches = matches;
+		slice->capacity = capacity;
+	}
+	slice->matches[slice->kept++] = where;
+	return true;
+}
+
+//settle: counts a slice again from where a match before it ends, until it meets a match it already counted
+static void settle(struct Slice *slice, long end) {
+	if (end <= slice->from) return;
+	struct Slice settled = {.limit = slice->limit, .last = -1};
+	int k = slice->first;
+	while (k+1 < slice->stop && search.pieces[k+1].start <= end) k++;
+	long i = end - search.pieces[k].start, m = 0;
+	bool met = false;
+	while (!met && find(search.pieces, search.count, &k, &i, slice->stop, search.needle, search.length)) {
+		long at = search.pieces[k].start + i;
+		while (m < slice->kept && slice->matches[m] < at) m++;
+		met = m < slice->kept && slice->matches[m] == at;
+		if (met) break;
+		settled.count++;
+		settled.last = at;
+		keep(&settled, at);
+		pass(search.pieces, search.count, &k, &i, search.length);
+	}
+	if (met) {
+		settled.count += slice->count - m;
+		settled.last = slice->last;
+		while (m < slice->kept && keep(&settled, slice->matches[m])) m++;
+	}
+	free(slice->matches);
+	slice->matches = settled.matches;
+	slice->count = settled.count;
+	slice->kept = settled.kept;
+	slice->capacity = settled.capacity;
+	slice->last = settled.last;
+}
+
+static bool find(struct Piece *pieces, int count, int *k, long *i, int stop, const char *needle, int n) {
+	for (; *k < stop; ++*k, *i = 0) {
+		struct Piece *piece = pieces + *k;
+		for (; *i < piece->length; ++*i) {
+			*i += candidate(piece->data + *i, piece->length - *i, needle, n);
+			if (*i < piece->length && matchAt(pieces, count, *k, *i, needle, n)) return true;
+		}
+	}
+	return false;
+}
+
+static bool matchAt(struct Piece *pieces, int count, int k, long i, const char *needle, int n) {
+	for (int j = 0; j < n; k++, i = 0) {
+		if (k >= count) return false;
+		long m = pieces[k].length - i < n - j ? pieces[k].length - i : n - j;
+		if (memcmp(pieces[k].data + i, needle + j, m)) return false;
+		j += m;
+	}
+	return true;
+}
+
+static void pass(struct Piece *pieces, int count, int *k, long *i, int n) {
+	for (*i += n; *k < count && *i >= pieces[*k].length; ++*k) *i -= pieces[*k].length;
+}
+
+//candidate: checks the first and last bytes of the needle, whole vectors at a time where it can
+static long candidate(const char *data, long length, const char *needle, int n) {
+	long i = 0;
+	#ifdef __SSE2__
+	i = avx2 ? scanAVX2(data, length, needle, n) : scanSSE2(data, length, needle, n);
+	#endif
+	while (i < length) {
+		const char *found = memchr(data + i, needle[0], length - i);
+		if (!found) return length;
+		i = found - data;
+		if (i + n > length || data[i + n-1] == needle[n-1]) return i;
+		i++;
+	}
+	return length;
+}
+
+#ifdef __SSE2__
+static void probe() {
+	avx2 = __builtin_cpu_supports("avx2");
+}
+
+static long scanSSE2(const char *data, long length, const char *needle, int n) {
+	__m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[n-1]);
+	long i = 0;
+	for (; i + n-1 + 16 <= length; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (data + i));
+		__m128i b = _mm_loadu_si128((const __m128i *) (data + i + n-1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static long scanAVX2(const char *data, long length, const char *needle, int n) {
+	__m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[n-1]);
+	long i = 0;
+	for (; i + n-1 + 32 <= length; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (data + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (data + i + n-1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+#endif
+
+static void replaceLiteral(struct Rebuild *r, const char *needle, int n, const char *replacement) {
+	doc_t *document = r->document;
+	long length = strlen(replacement);
+	int k = 0;
+	long i = 0;
+	while (!r->failed && find(document->pieces, document->count, &k, &i, document->count, needle, n)) {
+		long at = document->pieces[k].start + i;
+		replaced(r, at, at + n, replacement, length);
+		pass(document->pieces, document->count, &k, &i, n);
+	}
+}
+
+//replaceRegex: like sed, an empty match right after another match is skipped
+static void replaceRegex(struct Rebuild *r, regex_t *pattern, const char *replacement) {
+	doc_t *document = r->document;
+	char *line = NULL, *text = NULL;
+	long capacity = 0, size = 0;
+	int k = 0;
+	long i = 0;
+	for (long start = 0; start < document->length && !r->failed;) {
+		long end = document->length;
+		if (find(document->pieces, document->count, &k, &i, document->count, "\n", 1)) {
+			end = document->pieces[k].start + i;
+		}
+		if (end - start + 1 > capacity) {
+			free(line);
+			capacity = end - start + 1;
+			line = malloc(capacity);
+			if (!line) {
+				r->failed = true;
+				break;
+			}
+		}
+		copyOut(document, start, end, line);
+		line[end - start] = 0;
+		#ifndef REG_STARTEND
+		//without REG_STARTEND the rest of a line after a NUL can't be matched
+		if (memchr(line, 0, end - start)) {
+			r->failed = true;
+			break;
+		}
+		#endif
+		regmatch_t groups[10];
+		for (long at = 0, previous = -1; at <= end - start && !r->failed;) {
+			if (!matchFrom(pattern, line, at, end - start, groups)) break;
+			long from = groups[0].rm_so, to = groups[0].rm_eo;
+			if (from == to && from == previous) {
+				at = from + 1;
+				continue;
+			}
+			long length = expand(replacement, line, groups, &text, &size);
+			if (length < 0) r->failed = true;
+			else replaced(r, start + from, start + to, text, length);
+			previous = to;
+			at = to > from ? to : to + 1;
+		}
+		start = end + 1;
+		for (i++; k < document->count && i >= document->pieces[k].length; k++) i -= document->pieces[k].length;
+	}
+	free(line);
+	free(text);
+}
+
+static bool matchFrom(regex_t *pattern, const char *line, long at, long length, regmatch_t *groups) {
+	#ifdef REG_STARTEND
+	groups[0].rm_so = at;
+	groups[0].rm_eo = length;
+	return !regexec(pattern, line, 10, groups, REG_STARTEND | (at ? REG_NOTBOL : 0));
+	#else
+	(void) length;
+	if (regexec(pattern, line + at, 10, groups, at ? REG_NOTBOL : 0)) return false;
+	for (int g = 0; g < 10; g++) {
+		if (groups[g].rm_so < 0) continue;
+		groups[g].rm_so += at;
+		groups[g].rm_eo += at;
+	}
+	return true;
+	#endif
+}
+
+static long expand(const char *replacement, const char *line, regmatch_t *groups, char **out, long *size) {
+	long length = 0;
+	for (const char *c = replacement; *c; c++) {
+		const char *text = c;
+		long n = 1;
+		if (c[0] == '\\' && c[1] >= '0' && c[1] <= '9') {
+			regmatch_t *group = groups + (*++c - '0');
+			text = line + group->rm_so;
+			n = group->rm_so < 0 ? 0 : group->rm_eo - group->rm_so;
+		} else if (c[0] == '\\' && c[1] == '\\') {
+			c++;
+		}
+		if (length + n > *size) {
+			long grown = (length + n) * 2;
+			char *buffer = realloc(*out, grown);
+			if (!buffer) return -1;
+			*out = buffer;
+			*size = grown;
+		}
+		memcpy(*out + length, text, n);
+		length += n;
+	}
+	return length;
+}
+
+static void replaced(struct Rebuild *r, long from, long to, const char *text, long length) {
+	follow(r, from, to);
+	copyTo(r, from);
+	r->copied = to;
+	const char *kept = length > 0 ? stash(r->document, text, length) : NULL;
+	if (length > 0 && !kept) r->failed = true;
+	emit(r, kept, length);
+	r->matches++;
+}
+
+static bool track(struct Rebuild *r) {
+	int views = 0;
+	for (struct View *view = r->document->views; view; view = view->next) views++;
+	r->tracked = views*3;
+	r->positions = malloc((r->tracked ? r->tracked : 1) * (2*sizeof(long) + sizeof(bool)));
+	if (!r->positions) return false;
+	r->moved = r->positions + r->tracked;
+	r->followed = (bool *) (r->moved + r->tracked);
+	long *p = r->positions;
+	for (struct View *view = r->document->views; view; view = view->next) {
+		*p++ = view->cursor;
+		*p++ = view->selection;
+		*p++ = view->scroll;
+	}
+	memset(r->followed, 0, r->tracked * sizeof(bool));
+	return true;
+}
+
+//follow: positions within a match go to the start of its replacement
+static void follow(struct Rebuild *r, long from, long to) {
+	for (int j = 0; j < r->tracked; j++) {
+		if (r->followed[j] || r->positions[j] >= to) continue;
+		long p = r->positions[j] < from ? r->positions[j] : from;
+		r->moved[j] = r->length + p - r->copied;
+		r->followed[j] = true;
+	}
+}
+
+static void copyTo(struct Rebuild *r, long to) {
+	bool copy = to - r->copied < REPLACE_COPY;
+	while (r->copied < to && !r->failed) {
+		struct Piece *piece = r->document->pieces + r->k;
+		if (piece->start + piece->length <= r->copied) {
+			r->k++;
+			continue;
+		}
+		long end = piece->start + piece->length < to ? piece->start + piece->length : to;
+		const char *data = piece->data + (r->copied - piece->start);
+		if (copy) data = stash(r->document, data, end - r->copied);
+		if (!data) r->failed = true;
+		else emit(r, data, end - r->copied);
+		r->copied = end;
+	}
+}
+
+static void emit(struct Rebuild *r, const char *data, long length) {
+	struct Piece *last = r->count ? r->pieces + r->count-1 : NULL;
+	if (length > 0 && last && last->data + last->length == data && last->length + length <= CHUNK_SIZE) {
+		last->length += length;
+		r->length += length;
+		return;
+	}
+	for (long done = 0; done < length && !r->failed;) {
+		if (r->count == r->capacity) {
+			int capacity = r->capacity ? r->capacity*2 : 64;
+			struct Piece *pieces = realloc(r->pieces, capacity * sizeof(struct Piece));
+			if (!pieces) {
+				r->failed = true;
+				return;
+			}
+			r->pieces = pieces;
+			r->capacity = capacity;
+		}
+		long chunk = length - done < CHUNK_SIZE ? length - done : CHUNK_SIZE;
+		r->pieces[r->count++] = (struct Piece) {
+			.data = data + done, .length = chunk, .start = r->length, .newlines = -1
+		};
+		r->length += chunk;
+		done += chunk;
+	}
+}
+
+static long findIn(doc_t *document, const char *needle, int length, long from, long to) {
+	if (from >= to) return -1;
+	int k = pieceAt(document, from), stop = pieceAt(document, to-1) + 1;
+	long i = from - document->pieces[k].start;
+	if (!find(document->pieces, document->count, &k, &i, stop, needle, length)) return -1;
+	return document->pieces[k].start + i < to ? document->pieces[k].start + i : -1;
+}
+
+static int pieceAt(doc_t *document, long where) {
+	int low = 0, high = document->count - 1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (document->pieces[middle].start <= where) low = middle;
+		else high = middle - 1;
+	}
+	return low;
+}
+
+static long lastMatch(struct Slice *slice, long i) {
+	long low = -1, high = slice->kept - 1;
+	while (low < high) {
+		long middle = (low + high + 1) / 2;
+		if (slice->matches[middle] <= i) low = middle;
+		else high = middle - 1;
+	}
+	return low;
+}
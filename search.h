@@ -0,0 +1,29 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+
+#include "document.h"
+
+//the most threads a count is split across, and the least text worth giving one of them
+#define SEARCH_THREADS 16
+#define SEARCH_SLICE (1L<<20)
+
+//any more matches are only counted
+#define SEARCH_HIGHLIGHTS (1L<<20)
+
+//searched right away as the needle is typed, a match further away is left to the count
+#define SEARCH_NEAR (1L<<16)
+
+#define SEARCH_UNKNOWN -2
+
+long search_next(doc_t *document, const char *needle, int length, long from, long limit);
+long search_first(doc_t *document, long from);
+long search_replace(doc_t *document, const char *pattern, const char *replacement, bool regex);
+void search_start(doc_t *document, const char *needle, int length);
+void search_stop();
+bool search_poll(long *count);
+long search_version(doc_t *document);
+bool search_highlighted(doc_t *document, long i, long *next);
+
+#endif
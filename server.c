@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+//server: a later texi sends the absolute path of its file, or an empty one for a scratch document,
+//ended by a nul, and waits for a byte saying whether a window was opened for it
+
+//in seconds, either side gives up on the other after it
+#define SERVER_TIMEOUT 5
+
+//read a bit at a time as it arrives so that a slow client doesn't hold up the windows
+struct Client {
+	int fd;
+	char request[PATH_MAX];
+	long length;
+	time_t since;
+};
+
+static struct sockaddr_un address;
+static int listening = -1;
+static int client = -1;
+static struct Client clients[SERVER_CLIENTS];
+static int pending;
+
+static bool findAddress();
+static bool refused();
+static char *absolute(const char *path);
+static void setTimeout(int fd);
+
+bool server_forward(const char *path) {
+	if (!findAddress()) return false;
+	char *full = path ? absolute(path) : NULL;
+	if (path && !full) return false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	bool opened = false;
+	if (fd >= 0 && connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) {
+		setTimeout(fd);
+		char *request = full ? full : "";
+		long length = strlen(request) + 1, sent = 0;
+		for (ssize_t n; sent < length && (n = send(fd, request + sent, length - sent, MSG_NOSIGNAL)) > 0;) sent += n;
+		char answer = 0;
+		opened = sent == length && shutdown(fd, SHUT_WR) == 0 && read(fd, &answer, 1) == 1 && answer == 'y';
+	}
+	if (fd >= 0) close(fd);
+	free(full);
+	return opened;
+}
+
+int server_listen() {
+	if (!findAddress()) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+		bool stale = errno == EADDRINUSE && refused();
+		if (!stale || unlink(address.sun_path) < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+	if (listen(fd, 8) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		close(fd);
+		unlink(address.sun_path);
+		return -1;
+	}
+	listening = fd;
+	return fd;
+}
+
+int server_poll(struct pollfd *fds) {
+	fds[0] = (struct pollfd) {.fd = pending < SERVER_CLIENTS ? listening : -1, .events = POLLIN};
+	for (int i = 0; i < pending; i++) fds[i+1] = (struct pollfd) {.fd = clients[i].fd, .events = POLLIN};
+	return pending + 1;
+}
+
+//server_accept: returns false once no client has sent all of its request, those that sent something
+//else or stalled are answered and dropped, the one taken waits for server_answer
+bool server_accept(char **path) {
+	for (int fd; pending < SERVER_CLIENTS && (fd = accept(listening, NULL, NULL)) >= 0;) {
+		if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) close(fd);
+		else clients[pending++] = (struct Client) {.fd = fd, .since = time(NULL)};
+	}
+	for (int i = 0; i < pending; i++) {
+		struct Client *c = clients + i;
+		ssize_t n = -1;
+		while (c->length < PATH_MAX && (n = read(c->fd, c->request + c->length, PATH_MAX - c->length)) > 0) {
+			c->length += n;
+		}
+		bool waiting = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+		if (waiting && time(NULL) - c->since < SERVER_TIMEOUT) continue;
+		bool whole = n == 0 && c->length > 0 && !c->request[c->length-1], scratch = c->length == 1;
+		*path = whole && !scratch ? strdup(c->request) : NULL;
+		client = c->fd;
+		*c = clients[--pending];
+		i--;
+		if (whole && (scratch || *path)) return true;
+		server_answer(false);
+	}
+	return false;
+}
+
+void server_answer(bool opened) {
+	if (client < 0) return;
+	send(client, opened ? "y" : "n", 1, MSG_NOSIGNAL);
+	close(client);
+	client = -1;
+}
+
+void server_stop() {
+	while (pending) {
+		client = clients[--pending].fd;
+		server_answer(false);
+	}
+	if (listening < 0) return;
+	close(listening);
+	unlink(address.sun_path);
+	listening = -1;
+}
+
+//findAddress: in the user's runtime directory or else in a directory of their own under /tmp
+static bool findAddress() {
+	if (address.sun_family == AF_UNIX) return true;
+	char *display = getenv("DISPLAY");
+	if (!display || !*display) return false;
+	char directory[sizeof(address.sun_path)];
+	char *runtime = getenv("XDG_RUNTIME_DIR");
+	if (runtime && *runtime) {
+		snprintf(directory, sizeof(directory), "%s", runtime);
+	} else {
+		snprintf(directory, sizeof(directory), "/tmp/texi-%ld", (long) getuid());
+		mkdir(directory, 0700);
+		struct stat st;
+		if (lstat(directory, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || st.st_mode & 077) {
+			return false;
+		}
+	}
+	int length = snprintf(address.sun_path, sizeof(address.sun_path), "%s/texi%s", directory, display);
+	if (length < 0 || length >= (int) sizeof(address.sun_path)) return false;
+	//displays can be paths themselves, as with launchd
+	for (char *c = address.sun_path + strlen(directory) + 1; *c; c++) if (*c == '/') *c = '_';
+	address.sun_family = AF_UNIX;
+	return true;
+}
+
+static bool refused() {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return false;
+	bool gone = connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0 && errno == ECONNREFUSED;
+	close(fd);
+	return gone;
+}
+
+//absolute: the texi opening the file doesn't share the working directory
+static char *absolute(const char *path) {
+	if (path[0] == '/') return strdup(path);
+	char directory[PATH_MAX];
+	if (!getcwd(directory, sizeof(directory))) return NULL;
+	char *joined = malloc(strlen(directory) + strlen(path) + 2);
+	if (joined) sprintf(joined, "%s/%s", directory, path);
+	return joined;
+}
+
+static void setTimeout(int fd) {
+	struct timeval timeout = {SERVER_TIMEOUT, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
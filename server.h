@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <poll.h>
+
+#define SERVER_CLIENTS 8
+
+bool server_forward(const char *path);
+int server_listen();
+int server_poll(struct pollfd *fds);
+bool server_accept(char **path);
+void server_answer(bool opened);
+void server_stop();
+
+#endif
@@ -0,0 +1,43 @@
+#include "stats.h"
+#include "render.h"
+
+struct Stats stats;
+
+static double started;
+static long requests, advances;
+
+void stats_frameStart() {
+	started = now();
+}
+
+void stats_frameEnd() {
+	stats.last.time = now() - started;
+	stats.last.requests = stats.requests - requests;
+	stats.last.advances = stats.advances - advances;
+	requests = stats.requests;
+	advances = stats.advances;
+	stats.frames++;
+	stats.frameTime += stats.last.time;
+	if (stats.last.time > stats.worstFrame) stats.worstFrame = stats.last.time;
+}
+
+int stats_format(char *buffer, int size) {
+	int length = snprintf(
+		buffer, size,
+		"frame %.2fms (worst %.2fms) %ld requests %ld advances | moved %ldKB %ld reallocs %ld clipboard trips",
+		stats.last.time * 1000, stats.worstFrame * 1000, stats.last.requests, stats.last.advances,
+		stats.moved / 1024, stats.reallocs, stats.roundTrips
+	);
+	return length < size ? length : size - 1;
+}
+
+void stats_dump(FILE *file) {
+	long frames = stats.frames ? stats.frames : 1;
+	fprintf(file, "frames          %ld\n", stats.frames);
+	fprintf(file, "frame time      %.3fms average, %.3fms worst\n", stats.frameTime * 1000 / frames, stats.worstFrame * 1000);
+	fprintf(file, "X requests      %ld, %.1f per frame\n", stats.requests, (double) stats.requests / frames);
+	fprintf(file, "advances        %ld, %.1f per frame\n", stats.advances, (double) stats.advances / frames);
+	fprintf(file, "bytes moved     %ld\n", stats.moved);
+	fprintf(file, "reallocs        %ld\n", stats.reallocs);
+	fprintf(file, "clipboard trips %ld\n", stats.roundTrips);
+}
@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+//only compiled in with `make STATS=1`, elsewhere STAT costs nothing
+#ifdef STATS
+
+struct Stats {
+	long moved, reallocs, requests, advances, roundTrips;
+	long frames;
+	double frameTime, worstFrame;
+	struct {
+		long requests, advances;
+		double time;
+	} last;
+};
+
+extern struct Stats stats;
+
+#define STAT(counter, n) (stats.counter += (n))
+
+void stats_frameStart();
+void stats_frameEnd();
+int stats_format(char *buffer, int size);
+void stats_dump(FILE *file);
+
+#else
+#define STAT(counter, n) ((void) 0)
+#endif
+
+#endif
@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
@@ -13,117 +17,207 @@
 #include <X11/keysymdef.h>
 
 #include "clipboard.h"
+#include "document.h"
+#include "render.h"
+#include "search.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
+#include "xcore.h"
+#ifdef XRENDER
+#include "xrender.h"
+#endif
+#ifdef XSHM
+#include "xshm.h"
+#endif
 
 #define DARKMODE
+#define SMOOTHSCROLL
 
-typedef struct Document doc_t;
+#ifdef STATS
+#define OPTIONS "r:p:ns:fl:u:"
+#define USAGE "Usage: texi [-f [-l limit]] [-u limit] [-r trace] [-p trace [-n]] [-s stats] [file]\n"
+#else
+#define OPTIONS "r:p:nfl:u:"
+#define USAGE "Usage: texi [-f [-l limit]] [-u limit] [-r trace] [-p trace [-n]] [file]\n"
+#endif
 
 typedef void (*event_handler_t)(xcb_generic_event_t *);
 
-struct Document {
-	char *path, *data;
-	int length, size;
-	int scroll, cursor, selection;
-};
+struct Window;
+struct Pane;
 
 void setup();
 void cleanup();
+doc_t *openDocument(char *path);
+bool openWindow(doc_t *document, int width, int height);
+void acceptWindow();
+void closeWindow(struct Window *window);
+struct Pane *addPane(struct Window *window, int at, struct View *from);
+void removePane(struct Window *window, int at);
+void tile(struct Window *window);
+int paneAt(struct Window *window, int y);
+void focusPane(int k);
 void events();
-void draw(doc_t *document);
-
-void glyph(char c, int x, int y);
-int advance(char c);
+xcb_window_t eventWindow(xcb_generic_event_t *event);
+struct Window *windowOf(xcb_window_t id, struct Pane **pane);
+#ifdef XRENDER
+bool renderUse(uint32_t window);
+bool renderResize(int width, int height);
+#endif
+#ifdef XSHM
+bool sharedResize(int width, int height);
+#endif
 
 void handleClientMessage(xcb_client_message_event_t *event);
+void handleExpose(xcb_expose_event_t *event);
+void handleConfigureNotify(xcb_configure_notify_event_t *event);
 void handleButtonPress(xcb_button_press_event_t *event);
 void handleButtonRelease(xcb_button_release_event_t *event);
 void handleKeyPress(xcb_key_press_event_t *event);
-
-void action_quit(doc_t *);
-void action_save(doc_t *);
-void action_reload(doc_t *);
-void action_selectAll(doc_t *);
-
-void action_copy(doc_t *);
-void action_paste(doc_t *);
-void action_cut(doc_t *);
-
-void action_selectLeft(doc_t *);
-void action_selectRight(doc_t *);
-void action_selectUp(doc_t *);
-void action_selectDown(doc_t *);
-
-void action_cursorLeft(doc_t *);
-void action_cursorRight(doc_t *);
-void action_cursorUp(doc_t *);
-void action_cursorDown(doc_t *);
-
-void action_backspace(doc_t *);
-void action_newline(doc_t *);
-void action_tab(doc_t *document);
-
-doc_t *load(doc_t *document, char *path);
-void save(doc_t *document);
-
-int lengthen(doc_t *document, int length);
-void moveCursor(doc_t *document, int where);
-void moveSelection(doc_t *document, int where);
-void insert(doc_t *document, char *data, int length);
-void doInsertAction(doc_t *document, int where, int length, char *data);
-void doDeleteAction(doc_t *document, int from, int to);
-
-void copyFromClipboardTo(doc_t *document);
-void copyToClipboardFrom(doc_t *document);
-
-int isPositionOutsideBounds(doc_t *document, int p);
-int findPositionIn(doc_t *document, int mx, int y);
-
-void scrollUp(doc_t *);
-void scrollDown(doc_t *);
-int moveLineUp(char *d, int i, int length);
-int moveLineDown(char *d, int i, int length);
-
-int advanceSubline(char *d, int i, int length);
-int findWhitespaceFrom(char *d, int i);
-int startOfLine(char *d, int i);
-int getSubline(char *d, int i);
-
-void setColor(uint32_t fg, uint32_t bg);
+void pressKey(xcb_keysym_t keysym, uint16_t state);
+
+bool checkSave();
+bool checkLoad();
+bool checkSearch();
+bool checkFile();
+bool checkFollow();
+void checkJournal();
+void pinToEnd(struct Pane *pane);
+bool atEnd(struct View *view);
+void reloadDocument(doc_t *document);
+void showStatus(char *status);
+
+void traced(struct TraceEvent event);
+void replayNext();
+
+void action_quit(struct View *);
+void action_save(struct View *);
+void action_reload(struct View *);
+void action_selectAll(struct View *);
+
+void action_copy(struct View *);
+void action_paste(struct View *);
+void action_cut(struct View *);
+void action_undo(struct View *);
+void action_redo(struct View *);
+
+void action_selectLeft(struct View *);
+void action_selectRight(struct View *);
+void action_selectUp(struct View *);
+void action_selectDown(struct View *);
+
+void action_cursorLeft(struct View *);
+void action_cursorRight(struct View *);
+void action_cursorUp(struct View *);
+void action_cursorDown(struct View *);
+
+void action_backspace(struct View *);
+void action_newline(struct View *);
+void action_tab(struct View *view);
+void action_goToLine(struct View *);
+void action_find(struct View *);
+void action_replace(struct View *);
+void action_replaceRegex(struct View *);
+void action_split(struct View *);
+void action_unsplit(struct View *);
+void action_closeView(struct View *);
+void action_otherView(struct View *);
+void action_newWindow(struct View *);
+void action_follow(struct View *);
+#ifdef STATS
+void action_toggleStats(struct View *);
+#endif
+
+void openPrompt(char *label, void (*action)(struct View *, char *), void (*changed)(struct View *, char *));
+void promptKey(struct View *view, xcb_keysym_t keysym, bool shift);
+void goToLine(struct View *view, char *text);
+void findChanged(struct View *view, char *text);
+void findDone(struct View *view, char *text);
+void replaceWith(struct View *view, char *text);
+void replaceAll(struct View *view, char *text);
+
+void moveCursor(struct View *view, long where);
+void moveSelection(struct View *view, long where);
+void insert(struct View *view, char *data, long length);
+
+void copyFromClipboardTo(struct View *view);
+void copyToClipboardFrom(struct View *view);
+long sizeOf(const char *text);
+
+void scrollBy(struct Pane *pane, int pixels);
+long moveLineUp(struct View *view, long i);
+long moveLineDown(struct View *view, long i);
+
+int findWhitespaceFrom(doc_t *document, long i);
+
+void loadFontMetrics(xcb_font_t font, xcb_charinfo_t *metrics);
 xcb_keysym_t getKeysym(xcb_keycode_t keycode);
 
 char asciiupper(char c);
-void msleep(unsigned long ms);
 void die(char *msg);
 
-int dontExit = 1;
+//pinned panes keep to the end of a followed document as it grows
+struct Pane {
+	struct View view;
+	int top;
+	int scrollPending;
+	bool redraw, closing, pinned;
+};
+
+#define WINDOW_PANES 8
+
+//the pane with focus gets the keys and shows the prompt
+struct Window {
+	xcb_window_t id;
+	doc_t *document;
+	char *title;
+	char status[256];
+	struct Pane *panes[WINDOW_PANES];
+	int count, focus;
+	int width, height;
+	struct Prompt prompt;
+	char replacing[PROMPT_LENGTH];
+	bool replacingRegex;
+	bool closing;
+	struct Window *next;
+};
+
+struct Window *windows;
+struct Window *current;
+struct Window *finding;
+long findOrigin;
+bool findPending;
+char findLabel[32];
 
 xcb_connection_t *connection;
 xcb_gcontext_t graphics;
 xcb_window_t root;
+xcb_visualid_t visual;
 xcb_key_symbols_t *keySymbols;
-xcb_window_t window;
-xcb_atom_t wm_delete_window_atom;
-uint32_t bg, fg;
-
-char *defaultstr = "This is a scratch document, it isn't from a file, and thus will not be saved.";
+xcb_atom_t wm_protocols_atom, wm_delete_window_atom;
 
-uint16_t lineoffset = 0;
-uint16_t lineheight = 0;
-uint16_t advanceLookupTable[95];
-// advanceLookupTable starts from 0x20 'space'
+xcb_window_t clipboardWindow;
+int watching = -1;
+long followLimit = 0;
+long undoLimit = JOURNAL_LIMIT;
 
-uint16_t winwidth, winheight;
+struct Backend core = {xcore_use, xcore_forget, xcore_resize, xcore_fill, xcore_text, xcore_shift, xcore_present};
 
 const event_handler_t eventHandlers[] = {
 	[XCB_CLIENT_MESSAGE] = (event_handler_t) handleClientMessage,
+	[XCB_EXPOSE] = (event_handler_t) handleExpose,
+	[XCB_CONFIGURE_NOTIFY] = (event_handler_t) handleConfigureNotify,
 	[XCB_BUTTON_PRESS] = (event_handler_t) handleButtonPress,
 	[XCB_BUTTON_RELEASE] = (event_handler_t) handleButtonRelease,
 	[XCB_KEY_PRESS] = (event_handler_t) handleKeyPress,
 	[XCB_SELECTION_REQUEST] = (event_handler_t) clipboard_selectionRequest,
+	[XCB_PROPERTY_NOTIFY] = (event_handler_t) clipboard_propertyNotify,
 };
 
 struct Keybinding {
-	void (*action)(doc_t *);
+	void (*action)(struct View *);
 	xcb_keysym_t sym;
 	bool shift;
 	bool control;
@@ -133,8 +227,21 @@ struct Keybinding {
 	{action_copy, .control=true, .sym = XK_c},
 	{action_paste, .control=true, .sym = XK_v},
 	{action_cut, .control=true, .sym = XK_x},
+	{action_undo, .control=true, .sym = XK_z},
+	{action_redo, .control=true, .shift=true, .sym = XK_z},
+	{action_redo, .control=true, .sym = XK_y},
 	{action_save, .control=true, .sym = XK_s},
 	{action_reload, .control=true, .sym = XK_r},
+	{action_goToLine, .control=true, .sym = XK_g},
+	{action_find, .control=true, .sym = XK_f},
+	{action_replace, .control=true, .sym = XK_h},
+	{action_replaceRegex, .control=true, .shift=true, .sym = XK_h},
+	{action_split, .control=true, .sym = XK_2},
+	{action_unsplit, .control=true, .sym = XK_1},
+	{action_closeView, .control=true, .sym = XK_0},
+	{action_otherView, .control=true, .sym = XK_o},
+	{action_newWindow, .control=true, .sym = XK_n},
+	{action_follow, .control=true, .sym = XK_t},
 	
 	{action_cursorLeft, .sym = XK_Left},
 	{action_cursorRight, .sym = XK_Right},
@@ -150,25 +257,71 @@ struct Keybinding {
 	{action_newline, .sym = XK_Return},
 	{action_tab, .sym = XK_Tab},
 	
+	#ifdef STATS
+	{action_toggleStats, .sym = XK_F12},
+	#endif
+	
 	{NULL}
 };
 
-doc_t *globalDocument;
-
 int main(int argc, char **argv) {
-	doc_t *document = load(NULL,argc > 1 ? argv[1] : NULL);
-	globalDocument = document;
-	setup(argc > 1 ? argv[1] : "scratch file");
-	while (dontExit) events();
-	cleanup();
+	char *recording = NULL, *replaying = NULL, *statsPath = NULL;
+	bool headless = false, following = false;
+	for (int option; (option = getopt(argc, argv, OPTIONS)) != -1;) {
+		if (option == 'r') recording = optarg;
+		else if (option == 'p') replaying = optarg;
+		else if (option == 'n') headless = true;
+		else if (option == 's') statsPath = optarg;
+		else if (option == 'f') following = true;
+		else if (option == 'l') followLimit = sizeOf(optarg);
+		else if (option == 'u') undoLimit = sizeOf(optarg);
+		else die(USAGE);
+	}
+	if (followLimit < 0 || undoLimit < 0) die(USAGE);
+	char *path = optind < argc ? argv[optind] : NULL;
+	
+	//traces are of a single window, and the texi already running wouldn't know to follow the file
+	bool alone = recording || replaying;
+	if (!alone && !following && server_forward(path)) return 0;
+	if (!alone) watching = watch_start();
+	int width, height;
+	if (headless) {
+		if (!replaying || !trace_replay(replaying, true, &width, &height)) die("Unable to replay the trace!");
+		backend = nullBackend;
+		if (!openWindow(openDocument(path ? strdup(path) : NULL), width, height)) die("Unable to create document!");
+	} else {
+		setup();
+		if (!openWindow(openDocument(path ? strdup(path) : NULL), 150, 150)) die("Unable to create document!");
+		if (recording && !trace_record(recording, 150, 150)) die("Unable to record the trace!");
+		if (replaying && !trace_replay(replaying, false, &width, &height)) die("Unable to replay the trace!");
+		if (!alone) server_listen();
+	}
+	if (following) {
+		current = windows;
+		action_follow(&windows->panes[0]->view);
+	}
+	while (windows) events();
+	server_stop();
+	watch_stop();
+	trace_finish();
+	trace_report();
+	#ifdef STATS
+	FILE *statsFile = statsPath ? fopen(statsPath, "w") : stderr;
+	if (statsFile) stats_dump(statsFile);
+	if (statsFile && statsFile != stderr) fclose(statsFile);
+	#else
+	(void) statsPath;
+	#endif
+	if (!headless) cleanup();
 	return 0;
 }
 
-void setup(char *windowTitle) {
+void setup() {
 	connection = xcb_connect(NULL, NULL);
 	xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
 	
 	root = screen->root;
+	visual = screen->root_visual;
 	#ifdef DARKMODE
 	bg = screen->black_pixel;
 	fg = screen->white_pixel;
@@ -182,6 +335,11 @@ void setup(char *windowTitle) {
 	);
 	wm_delete_window_atom = atom_reply->atom;
 	free(atom_reply);
+	atom_reply = xcb_intern_atom_reply(
+		connection, xcb_intern_atom(connection, 0, 12, "WM_PROTOCOLS"), 0
+	);
+	wm_protocols_atom = atom_reply->atom;
+	free(atom_reply);
 	
 	graphics = xcb_generate_id(connection);
 	
@@ -194,542 +352,968 @@ void setup(char *windowTitle) {
 		connection, graphics, root,
 		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND
 			| XCB_GC_FONT | XCB_GC_GRAPHICS_EXPOSURES,
-		(uint32_t[]) {fg, bg, font, 1}
+		(uint32_t[]) {fg, bg, font, 0}
 	);
 	
-	xcb_query_text_extents_cookie_t advancesCookies[95];
-	for (char c = 0x20; c < 0x7F; c++) {
-		advancesCookies[c-0x20] = xcb_query_text_extents(
-			connection, font, 1, (xcb_char2b_t[]){{0,c}}
-		);
-	}
-	xcb_close_font(connection, font);
-	for (char c = 0x20; c < 0x7F; c++) {
-		xcb_query_text_extents_reply_t *reply = xcb_query_text_extents_reply(
-			connection, advancesCookies[c-0x20], NULL
-		);
-		advanceLookupTable[c-0x20] = reply->overall_width;
-		if (lineoffset < reply->font_ascent) lineoffset = reply->font_ascent;
-		if (lineheight < reply->font_ascent + reply->font_descent) {
-			lineheight = reply->font_ascent + reply->font_descent;
-		}
-		free(reply);
-	}
+	xcb_charinfo_t metrics[95];
+	loadFontMetrics(font, metrics);
 	
 	keySymbols = xcb_key_symbols_alloc(connection);
 	if (!keySymbols) die("Could not access key symbols!");
 	
-	window = xcb_generate_id(connection);
+	xcore_init(connection, graphics, screen->root_depth);
+	#ifdef XRENDER
+	if (xrender_init(
+		connection, screen, font, metrics, lineoffset, lineheight - lineoffset,
+		(uint32_t[]) {fg, bg}, 2
+	)) {
+		core.use = renderUse;
+		core.resize = renderResize;
+		core.text = xrender_text;
+	}
+	#endif
+	backend = core;
+	#ifdef XSHM
+	if (xshm_init(
+		connection, screen, graphics, font, metrics, lineoffset, lineheight - lineoffset
+	)) backend = (struct Backend) {
+		xshm_use, xshm_forget, sharedResize, xshm_fill, xshm_text, xshm_shift, xshm_present
+	};
+	#endif
+	xcb_close_font(connection, font);
+	
+	clipboardWindow = xcb_generate_id(connection);
 	xcb_create_window(
 		connection, XCB_COPY_FROM_PARENT,
-		window, screen->root,
-		0, 0, 150, 150, 10,
-		XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
-		XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
-		(uint32_t[]) {
-			bg,
-			XCB_EVENT_MASK_EXPOSURE
-			| XCB_EVENT_MASK_KEY_PRESS
-			| XCB_EVENT_MASK_BUTTON_PRESS
-			| XCB_EVENT_MASK_BUTTON_RELEASE
-			
-		}
-	);
-	xcb_map_window(connection, window);
-	
-	xcb_change_property (
-		connection, XCB_PROP_MODE_REPLACE, window,
-		XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
-		strlen(windowTitle), windowTitle
+		clipboardWindow, root,
+		0, 0, 1, 1, 0,
+		XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT,
+		0, NULL
 	);
-	
-	clipboard_init(connection, window, "TEXI_CLIPBOARD");
-	
-	xcb_flush(connection);
+	clipboard_init(connection, clipboardWindow, "TEXI_CLIPBOARD");
 }
 
 void cleanup() {
 	xcb_key_symbols_free(keySymbols);
-	xcb_destroy_window(connection, window);
+	xcb_destroy_window(connection, clipboardWindow);
 	
 	xcb_flush(connection);
 	xcb_disconnect(connection);
 }
 
-static inline char hexdigit(unsigned char c) {return (c&0xf)>=10 ? (c&0xf)-10+'a' : (c&0xf)+'0';}
+doc_t *openDocument(char *path) {
+	struct stat wanted, open;
+	for (struct Window *window = windows; path && window; window = window->next) {
+		char *other = window->document->path;
+		if (
+			other && stat(path, &wanted) == 0 && stat(other, &open) == 0
+			&& wanted.st_dev == open.st_dev && wanted.st_ino == open.st_ino
+		) {
+			free(path);
+			return window->document;
+		}
+	}
+	doc_t *document = load(NULL, path);
+	if (!document) free(path);
+	else document->journal.limit = undoLimit;
+	if (document && path) watch_file(path);
+	return document;
+}
 
-void glyph(char c, int x, int y) {
-	if (c == '\t') {
-		xcb_image_text_8(
-			connection, 1, window, graphics,
-			x, lineoffset+y, " "
+bool openWindow(doc_t *document, int width, int height) {
+	struct Window *window = document ? calloc(1, sizeof(struct Window)) : NULL;
+	if (!window) {
+		if (document && !document->views) unload(document);
+		return false;
+	}
+	window->document = document;
+	window->title = document->path ? document->path : "scratch file";
+	window->width = width;
+	window->height = height;
+	if (connection) {
+		window->id = xcb_generate_id(connection);
+		xcb_create_window(
+			connection, XCB_COPY_FROM_PARENT,
+			window->id, root,
+			0, 0, width, height, 10,
+			XCB_WINDOW_CLASS_INPUT_OUTPUT, visual,
+			XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
+			(uint32_t[]) {
+				bg,
+				XCB_EVENT_MASK_STRUCTURE_NOTIFY
+				| XCB_EVENT_MASK_KEY_PRESS
+			}
 		);
-	} else if (c >= 0x20 && c < 0x7F) {
-		xcb_image_text_8(
-			connection, 1, window, graphics,
-			x, lineoffset+y, &c
+		//closing a window from the window manager only closes that one
+		xcb_change_property(
+			connection, XCB_PROP_MODE_REPLACE, window->id,
+			wm_protocols_atom, XCB_ATOM_ATOM, 32, 1, &wm_delete_window_atom
 		);
-	} else {
-		char buffer[4];
-		buffer[0] = '[';
-		buffer[1] = hexdigit(((unsigned char)c)<<4);
-		buffer[2] = hexdigit(c);
-		buffer[3] = ']';
-		xcb_image_text_8(
-			connection, 4, window, graphics,
-			x, lineoffset+y, buffer
+	}
+	if (!addPane(window, 0, NULL)) {
+		if (connection) xcb_destroy_window(connection, window->id);
+		if (!document->views) unload(document);
+		free(window);
+		return false;
+	}
+	window->next = windows;
+	windows = current = window;
+	if (connection) {
+		xcb_map_window(connection, window->id);
+		showStatus(NULL);
+	}
+	tile(window);
+	return true;
+}
+
+void acceptWindow() {
+	char *path;
+	while (server_accept(&path)) server_answer(openWindow(openDocument(path), 150, 150));
+}
+
+void closeWindow(struct Window *window) {
+	for (struct Window **link = &windows; *link; link = &(*link)->next) {
+		if (*link == window) {
+			*link = window->next;
+			break;
+		}
+	}
+	if (finding == window) {
+		search_stop();
+		finding = NULL;
+	}
+	if (current == window) current = windows;
+	doc_t *document = window->document;
+	while (window->count) removePane(window, window->count-1);
+	if (connection) xcb_destroy_window(connection, window->id);
+	if (!document->views) {
+		waitForSave(document);
+		if (connection) clipboard_keep();
+		if (document->path) watch_forget(document->path);
+		unload(document);
+	}
+	free(window);
+}
+
+struct Pane *addPane(struct Window *window, int at, struct View *from) {
+	if (window->count == WINDOW_PANES) return NULL;
+	struct Pane *pane = calloc(1, sizeof(struct Pane));
+	if (!pane) return NULL;
+	struct View *view = &pane->view;
+	addView(window->document, view);
+	if (from) {
+		view->scroll = from->scroll;
+		view->scrollOffset = from->scrollOffset;
+		view->cursor = from->cursor;
+		view->selection = from->selection;
+	}
+	if (connection) {
+		//the border is the line between panes, the one of the next pane lies on top of it
+		view->window = xcb_generate_id(connection);
+		xcb_create_window(
+			connection, XCB_COPY_FROM_PARENT,
+			view->window, window->id,
+			-1, -1, 1, 1, 1,
+			XCB_WINDOW_CLASS_INPUT_OUTPUT, visual,
+			XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK,
+			(uint32_t[]) {
+				bg, fg,
+				XCB_EVENT_MASK_EXPOSURE
+				| XCB_EVENT_MASK_BUTTON_PRESS
+				| XCB_EVENT_MASK_BUTTON_RELEASE
+			}
 		);
+		xcb_map_window(connection, view->window);
 	}
+	memmove(window->panes + at+1, window->panes + at, (window->count - at) * sizeof(struct Pane *));
+	window->panes[at] = pane;
+	window->count++;
+	return pane;
 }
 
-int advance(char c) {
-	if (c == '\t') {
-		return 24;
-	} else if (c >= 0x20 && c < 0x7F) {
-		return advanceLookupTable[c-0x20];
-	} else {
-		return advanceLookupTable[hexdigit(c)-0x20]
-			+ advanceLookupTable[hexdigit(((unsigned char)c)<<4)-0x20]
-			+ advanceLookupTable['['-0x20] + advanceLookupTable[']'-0x20];
+void removePane(struct Window *window, int at) {
+	struct Pane *pane = window->panes[at];
+	forgetCanvas(&pane->view);
+	if (connection) xcb_destroy_window(connection, pane->view.window);
+	removeView(&pane->view);
+	free(pane);
+	window->count--;
+	memmove(window->panes + at, window->panes + at+1, (window->count - at) * sizeof(struct Pane *));
+	if (window->focus > at || (window->focus == window->count && window->focus > 0)) window->focus--;
+}
+
+void tile(struct Window *window) {
+	int top = 0;
+	for (int k = 0; k < window->count; k++) {
+		struct Pane *pane = window->panes[k];
+		struct View *view = &pane->view;
+		int bottom = (window->height + 1) * (k+1) / window->count - 1;
+		int height = bottom > top ? bottom - top : 1;
+		bool resized = view->width != window->width || view->height != height;
+		if (connection && (resized || pane->top != top)) xcb_configure_window(
+			connection, view->window,
+			XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+			(uint32_t[]) {-1, top-1, window->width, height}
+		);
+		pane->top = top;
+		if (resized && !resizeCanvas(view, window->width, height)) die("Unable to create the canvas!");
+		if (resized) pane->redraw = true;
+		top = bottom + 1;
 	}
 }
 
+int paneAt(struct Window *window, int y) {
+	int k = window->count-1;
+	while (k > 0 && window->panes[k]->top - 1 > y) k--;
+	return k;
+}
+
+void focusPane(int k) {
+	current->panes[current->focus]->redraw = true;
+	current->focus = k;
+	current->panes[k]->redraw = true;
+}
+
+//events: a replay feeds one event from the trace per frame instead of the user's input
 void events() {
-	xcb_generic_event_t *event = xcb_wait_for_event(connection);
-	do {
+	xcb_generic_event_t *event;
+	while (connection && (event = clipboard_nextEvent())) {
 		uint8_t evtype = event->response_type & ~0x80;
-		if (evtype < sizeof(eventHandlers)/sizeof(event_handler_t) && eventHandlers[evtype]) {
+		bool input = evtype == XCB_KEY_PRESS || evtype == XCB_BUTTON_PRESS
+			|| evtype == XCB_BUTTON_RELEASE || evtype == XCB_CONFIGURE_NOTIFY;
+		xcb_window_t id = eventWindow(event);
+		struct Pane *pane;
+		struct Window *window = id ? windowOf(id, &pane) : NULL;
+		if (
+			evtype < sizeof(eventHandlers)/sizeof(event_handler_t) && eventHandlers[evtype]
+			&& (window || !id) && !(input && trace_replaying())
+		) {
+			if (window) current = window;
+			//clicks are kept as they are in the whole window, which is what traces store
+			if (pane && (evtype == XCB_BUTTON_PRESS || evtype == XCB_BUTTON_RELEASE)) {
+				((xcb_button_press_event_t *) event)->event_y += pane->top;
+			}
 			eventHandlers[evtype](event);
 		}
 		free(event);
-		xcb_flush(connection);
-	} while ((event = xcb_poll_for_event(connection)));
+	}
+	if (connection && xcb_connection_has_error(connection)) die("Lost the connection to the X server!");
+	if (trace_replaying()) {
+		current = windows;
+		replayNext();
+	}
+	for (struct Window *window = windows, *next; window; window = next) {
+		next = window->next;
+		bool closed = false;
+		for (int k = window->count-1; k >= 0; k--) {
+			if (!window->panes[k]->closing) continue;
+			removePane(window, k);
+			closed = true;
+		}
+		if (window->closing || !window->count) closeWindow(window);
+		else if (closed) tile(window);
+	}
 	
-	xcb_get_geometry_reply_t* geom = xcb_get_geometry_reply(
-		connection, xcb_get_geometry(connection, window), 0
-	);
-	winwidth = geom->width;
-	winheight = geom->height;
-	free(geom);
+	//files are brought up to date before anything is drawn, as every view of one can change
+	bool changing = false;
+	for (current = windows; current; current = current->next) changing |= checkFile();
+	for (current = windows; current; current = current->next) checkJournal();
 	
-	draw(globalDocument);
+	bool loading = false, searching = false, scrolling = false, saving = false;
+	for (current = windows; current; current = current->next) {
+		loading |= checkLoad();
+		searching |= checkSearch();
+		for (int k = 0; k < current->count; k++) {
+			struct Pane *pane = current->panes[k];
+			struct View *view = &pane->view;
+			if (pane->scrollPending) {
+				int step = pane->scrollPending / 4;
+				if (step == 0) step = pane->scrollPending > 0 ? 1 : -1;
+				scrollBy(pane, step);
+				pane->scrollPending -= step;
+				pane->redraw = true;
+			}
+			scrolling |= pane->scrollPending != 0;
+			if (pane->redraw || view->damage.active || view->shown.matches != search_version(view->document)) {
+				draw(view, k == current->focus ? &current->prompt : NULL);
+				pane->redraw = false;
+			}
+		}
+		if (connection) saving |= checkSave();
+	}
+	current = windows;
+	if (!connection) {
+		trace_flushed();
+		return;
+	}
 	xcb_flush(connection);
-	msleep(25);
+	trace_flushed();
+	if (!windows) return;
+	//later texis still sending are dropped once they stall
+	struct pollfd fds[3 + SERVER_CLIENTS] = {
+		{.fd = xcb_get_file_descriptor(connection), .events = POLLIN},
+		{.fd = watching, .events = POLLIN}
+	};
+	int count = 2 + server_poll(fds + 2);
+	bool serving = count > 3, sending = clipboard_expire();
+	poll(
+		fds, count,
+		trace_replaying() || clipboard_pending() ? 0 : scrolling || searching ? 16 : loading || changing ? 50 : saving ? 100 : serving || sending ? 1000 : -1
+	);
+	if (fds[1].revents & POLLIN) watch_read();
+	bool sent = serving;
+	for (int i = 2; i < count; i++) sent |= fds[i].revents != 0;
+	if (sent) acceptWindow();
 }
 
-void drawCursor(uint16_t x, uint16_t y) {
-	xcb_poly_line(
-		connection, 0, window, graphics, 2,
-		(const xcb_point_t[]) {{x, y}, {x, y+lineheight}}
-	);
+xcb_window_t eventWindow(xcb_generic_event_t *event) {
+	switch (event->response_type & ~0x80) {
+		case XCB_KEY_PRESS: return ((xcb_key_press_event_t *) event)->event;
+		case XCB_BUTTON_PRESS: return ((xcb_button_press_event_t *) event)->event;
+		case XCB_BUTTON_RELEASE: return ((xcb_button_release_event_t *) event)->event;
+		case XCB_CONFIGURE_NOTIFY: return ((xcb_configure_notify_event_t *) event)->window;
+		case XCB_EXPOSE: return ((xcb_expose_event_t *) event)->window;
+		case XCB_CLIENT_MESSAGE: return ((xcb_client_message_event_t *) event)->window;
+		default: return XCB_NONE;
+	}
 }
 
-void draw(doc_t *document) {
-	xcb_clear_area(connection, 0, window, 0, 0, 0, 0);
-	int x = 0, y = 0;
-	char *d = document->data;
-	
-	int cur = document->cursor, sel = document->selection;
-	if (cur > sel) {int _t = sel; sel = cur; cur = _t;}
-	
-	if (cur < document->scroll && sel > document->scroll) setColor(bg, fg);
-	else setColor(fg, bg);
-	
-	int i = document->scroll;
-	while (i < document->length && y <= winheight) {
-		bool drawc = false;
-		if (i == cur && cur == sel) drawc = true;
-		else if (i == cur) setColor(bg, fg);
-		else if (i == sel) setColor(fg, bg);
-		if (d[i] == '\n' || x + advance(d[i]) >= winwidth) {
-			if (d[i] == '\n') {
-				glyph(' ', x, y);
-				if (drawc) drawCursor(x,y);
-				i++;
-			}
-			y += lineheight;
-			x = 0;
-		} else {
-			glyph(d[i], x, y);
-			if (drawc) drawCursor(x,y);
-			x += advance(d[i++]);
+struct Window *windowOf(xcb_window_t id, struct Pane **pane) {
+	*pane = NULL;
+	for (struct Window *window = windows; window; window = window->next) {
+		if (window->id == id) return window;
+		for (int k = 0; k < window->count; k++) {
+			if (window->panes[k]->view.window != id) continue;
+			*pane = window->panes[k];
+			return window;
+		}
+	}
+	return NULL;
+}
+
+bool checkSave() {
+	long written, length;
+	enum SaveState state = saveProgress(current->document, &written, &length);
+	if (state == SAVE_WRITING) {
+		char status[32];
+		snprintf(status, sizeof(status), "saving %d%%", length ? (int) (written * 100 / length) : 0);
+		showStatus(status);
+	} else if (state == SAVE_DONE) {
+		showStatus(NULL);
+	} else if (state == SAVE_FAILED) {
+		showStatus("save failed");
+	}
+	return state == SAVE_WRITING;
+}
+
+bool checkLoad() {
+	doc_t *document = current->document;
+	long length = document->length;
+	bool loading = loadMore(document);
+	if (loading) {
+		char status[32];
+		snprintf(status, sizeof(status), "loading %ldKB", document->length / 1024);
+		showStatus(status);
+	} else if (document->length != length) {
+		showStatus(NULL);
+	}
+	return loading;
+}
+
+bool checkSearch() {
+	struct Prompt *prompt = &current->prompt;
+	struct View *view = &current->panes[current->focus]->view;
+	if (current != finding || prompt->action != findDone) return false;
+	if (view->damage.active) search_start(current->document, prompt->text, prompt->length);
+	long count;
+	bool counting = search_poll(&count);
+	//a match too far away to search for as the needle was typed is selected once the count gets to it
+	long found = findPending ? search_first(current->document, findOrigin) : SEARCH_UNKNOWN;
+	if (found != SEARCH_UNKNOWN) {
+		findPending = false;
+		if (found >= 0) {
+			moveCursor(view, found);
+			moveSelection(view, found + prompt->length);
+		}
+	}
+	if (!prompt->length) snprintf(findLabel, sizeof(findLabel), "find: ");
+	else snprintf(findLabel, sizeof(findLabel), "find (%ld%s): ", count, counting ? "+" : "");
+	return counting;
+}
+
+bool checkFile() {
+	doc_t *document = current->document;
+	if (document->following.active) return checkFollow();
+	if (!document->path || !watch_changed(document->path)) return false;
+	enum Refresh result = refresh(document);
+	if (result == REFRESH_LATER) return true;
+	watch_seen(document->path);
+	if (result == REFRESH_RELOAD) reloadDocument(document);
+	if (result == REFRESH_EDITED) showStatus(cutShort(document) ? "cut short on disk" : "changed on disk");
+	else if (result == REFRESH_SPLICED || result == REFRESH_RELOAD) showStatus("reloaded");
+	return false;
+}
+
+//checkFollow: a file is looked at again every time when nothing says when it changes
+bool checkFollow() {
+	doc_t *document = current->document;
+	bool more = followMore(document);
+	bool over = document->following.limit && document->length > document->following.limit;
+	if (over || document->following.truncated) {
+		if (connection) clipboard_keep();
+		if (finding && finding->document == document) search_stop();
+		trim(document);
+	}
+	for (int k = 0; k < current->count; k++) {
+		struct Pane *pane = current->panes[k];
+		if (pane->pinned && pane->view.cursor != document->length) pinToEnd(pane);
+	}
+	watch_seen(document->path);
+	return more || watching < 0;
+}
+
+//checkJournal: the blocks forgotten edits held on to are freed once there's enough of them
+void checkJournal() {
+	doc_t *document = current->document;
+	if (!reclaimable(document)) return;
+	if (connection) clipboard_keep();
+	if (finding && finding->document == document) search_stop();
+	reclaim(document);
+}
+
+void pinToEnd(struct Pane *pane) {
+	struct View *view = &pane->view;
+	long row = startOfRow(view, view->document->length);
+	for (int y = 2*lineheight; y <= view->height; y += lineheight) {
+		long previous = previousRow(view, row);
+		if (previous < 0) break;
+		row = previous;
+	}
+	moveCursor(view, view->document->length);
+	view->scroll = row;
+	view->scrollOffset = 0;
+	pane->scrollPending = 0;
+	pane->pinned = true;
+	pane->redraw = true;
+}
+
+bool atEnd(struct View *view) {
+	doc_t *document = view->document;
+	return document->following.active && view->cursor == document->length && view->selection == view->cursor;
+}
+
+//reloadDocument: the clipboard and the search both point into the text being dropped
+void reloadDocument(doc_t *document) {
+	if (connection) clipboard_keep();
+	if (finding && finding->document == document) search_stop();
+	bool following = document->following.active;
+	reload(document);
+	if (following) startFollowing(document, followLimit);
+}
+
+void showStatus(char *status) {
+	if (!connection) return;
+	for (struct Window *window = windows; window; window = window->next) {
+		if (window->document != current->document) continue;
+		char title[sizeof(window->status)];
+		if (status) snprintf(title, sizeof(title), "%s (%s)", window->title, status);
+		else snprintf(title, sizeof(title), "%s", window->title);
+		if (!strcmp(title, window->status)) continue;
+		strcpy(window->status, title);
+		xcb_change_property(
+			connection, XCB_PROP_MODE_REPLACE, window->id,
+			XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+			strlen(title), title
+		);
+	}
+}
+
+#ifdef XRENDER
+bool renderUse(uint32_t window) {
+	if (!xcore_use(window)) return false;
+	if (xcore_canvas()) xrender_target(xcore_canvas());
+	return true;
+}
+
+bool renderResize(int width, int height) {
+	if (!xcore_resize(width, height)) return false;
+	xrender_target(xcore_canvas());
+	return true;
+}
+#endif
+
+#ifdef XSHM
+bool sharedResize(int width, int height) {
+	if (xshm_resize(width, height)) return true;
+	backend = core;
+	for (struct Window *window = windows; window; window = window->next) {
+		for (int k = 0; k < window->count; k++) {
+			struct View *view = &window->panes[k]->view;
+			xshm_forget(view->window);
+			if (!resizeCanvas(view, view->width, view->height)) return false;
+			window->panes[k]->redraw = true;
 		}
 	}
-	if (i == cur && cur == sel) drawCursor(x,y);
+	return true;
 }
+#endif
 
 void handleClientMessage(xcb_client_message_event_t *event) {
-	dontExit = event->data.data32[0] != wm_delete_window_atom;
+	if (event->data.data32[0] != wm_delete_window_atom) return;
+	traced((struct TraceEvent) {.type = TRACE_CLOSE});
+	current->closing = true;
+}
+
+//handleExpose: the canvas still holds the frame, so exposed parts are just copied back
+void handleExpose(xcb_expose_event_t *event) {
+	struct Pane *pane;
+	if (!windowOf(event->window, &pane) || !pane) return;
+	if (!showCanvas(&pane->view, event->y, event->height)) pane->redraw = true;
+}
+
+void handleConfigureNotify(xcb_configure_notify_event_t *event) {
+	if (event->width == current->width && event->height == current->height) return;
+	traced((struct TraceEvent) {.type = TRACE_RESIZE, .x = event->width, .y = event->height});
+	current->width = event->width;
+	current->height = event->height;
+	tile(current);
 }
 
 void handleButtonPress(xcb_button_press_event_t *event) {
+	traced((struct TraceEvent) {
+		.type = TRACE_BUTTON_PRESS, .detail = event->detail, .state = event->state,
+		.x = event->event_x, .y = event->event_y
+	});
+	int k = paneAt(current, event->event_y);
+	struct Pane *pane = current->panes[k];
+	pane->redraw = true;
 	if (event->detail == 1) {
-		moveCursor(globalDocument,
-			findPositionIn(globalDocument, event->event_x, event->event_y)
+		focusPane(k);
+		moveCursor(&pane->view,
+			findPositionIn(&pane->view, event->event_x, event->event_y - pane->top)
 		);
-	} else if (event->detail == 5) {
-		scrollDown(globalDocument);
-		scrollDown(globalDocument);
-	} else if (event->detail == 4) {
-		scrollUp(globalDocument);
-		scrollUp(globalDocument);
+		pane->pinned = atEnd(&pane->view);
+	} else if (event->detail == 5 || event->detail == 4) {
+		if (event->detail == 4) pane->pinned = false;
+		int pixels = event->detail == 5 ? 2*lineheight : -2*lineheight;
+		#ifdef SMOOTHSCROLL
+		pane->scrollPending += pixels;
+		#else
+		scrollBy(pane, pixels);
+		#endif
 	}
 }
 
 void handleKeyPress(xcb_key_press_event_t *event) {
-	xcb_keysym_t keysym = xcb_key_symbols_get_keysym(keySymbols, event->detail, 0);
-	int initialSelection = globalDocument->selection;
+	pressKey(xcb_key_symbols_get_keysym(keySymbols, event->detail, 0), event->state);
+}
+
+//pressKey: traces store keysyms since keycodes differ between keyboards
+void pressKey(xcb_keysym_t keysym, uint16_t state) {
+	traced((struct TraceEvent) {.type = TRACE_KEY, .state = state, .value = keysym});
+	struct Pane *pane = current->panes[current->focus];
+	struct View *view = &pane->view;
+	long initialSelection = view->selection;
+	pane->redraw = true;
 	
-	bool control = event->state & XCB_MOD_MASK_CONTROL;
-	bool shift = event->state & (XCB_MOD_MASK_SHIFT | XCB_MOD_MASK_LOCK);
+	bool control = state & XCB_MOD_MASK_CONTROL;
+	bool shift = state & (XCB_MOD_MASK_SHIFT | XCB_MOD_MASK_LOCK);
 	
-	if (!control && keysym >= XK_space && keysym <= XK_asciitilde) {
+	if (current->prompt.action && !control) {
+		promptKey(view, keysym, shift);
+	} else if (!control && keysym >= XK_space && keysym <= XK_asciitilde) {
 		char c = shift ? asciiupper(keysym) : (char) keysym;
-		insert(globalDocument, &c, 1);
+		insert(view, &c, 1);
 	} else for (struct Keybinding *key = keys; key->action; key++) {
 		if (keysym == key->sym && control == key->control && shift == key->shift) {
-			key->action(globalDocument);
+			key->action(view);
 		}
 	}
 	
-	if (
-		initialSelection != globalDocument->selection
-		&& isPositionOutsideBounds(globalDocument, globalDocument->selection)
-	) globalDocument->scroll = startOfLine(
-		globalDocument->data, globalDocument->selection
-	);
+	if (initialSelection != view->selection && isPositionOutsideBounds(view, view->selection)) {
+		view->scroll = startOfRow(view, view->selection);
+		view->scrollOffset = 0;
+		pane->scrollPending = 0;
+	}
+	pane->pinned = atEnd(view);
 }
 
 void handleButtonRelease(xcb_button_release_event_t *event) {
+	traced((struct TraceEvent) {
+		.type = TRACE_BUTTON_RELEASE, .detail = event->detail, .state = event->state,
+		.x = event->event_x, .y = event->event_y
+	});
+	struct Pane *pane = current->panes[current->focus];
+	pane->redraw = true;
 	if (event->detail == 1) {
-		moveSelection(globalDocument, 
-			findPositionIn(globalDocument, event->event_x, event->event_y)
+		moveSelection(&pane->view,
+			findPositionIn(&pane->view, event->event_x, event->event_y - pane->top)
 		);
+		pane->pinned = atEnd(&pane->view);
 	}
 }
 
-void action_quit(doc_t *document) {(void) document; dontExit = 0;}
+void traced(struct TraceEvent event) {
+	trace_dispatched();
+	trace_write(&event, NULL);
+}
 
-void action_selectAll(doc_t *doc) {moveCursor(doc, 0); moveSelection(doc, doc->length);}
+void replayNext() {
+	struct TraceEvent event;
+	if (!trace_read(&event)) {
+		trace_finish();
+		for (struct Window *window = windows; window; window = window->next) window->closing = true;
+		return;
+	}
+	if (event.type == TRACE_KEY) {
+		pressKey(event.value, event.state);
+	} else if (event.type == TRACE_BUTTON_PRESS || event.type == TRACE_BUTTON_RELEASE) {
+		xcb_button_press_event_t button = {
+			.detail = event.detail, .state = event.state, .event_x = event.x, .event_y = event.y
+		};
+		if (event.type == TRACE_BUTTON_PRESS) handleButtonPress(&button);
+		else handleButtonRelease(&button);
+	} else if (event.type == TRACE_RESIZE) {
+		handleConfigureNotify(&(xcb_configure_notify_event_t) {.width = event.x, .height = event.y});
+	} else if (event.type == TRACE_CLOSE) {
+		handleClientMessage(&(xcb_client_message_event_t) {.data.data32 = {wm_delete_window_atom}});
+	}
+}
 
-void action_copy(doc_t *document) {copyToClipboardFrom(document);}
-void action_paste(doc_t *document) {copyFromClipboardTo(document);}
-void action_cut(doc_t *doc) {copyToClipboardFrom(doc); insert(doc, "", 0);}
+void action_quit(struct View *view) {(void) view; current->closing = true;}
 
-void action_save(doc_t *document) {save(document);}
-void action_reload(doc_t *document) {load(document, NULL);}
+void action_selectAll(struct View *view) {moveCursor(view, 0); moveSelection(view, view->document->length);}
 
-void action_selectLeft(doc_t *doc) {moveSelection(doc, doc->selection-1);}
-void action_cursorLeft(doc_t *doc) {moveCursor(doc, doc->cursor-1);}
-void action_selectRight(doc_t *doc) {moveSelection(doc, doc->selection+1);}
-void action_cursorRight(doc_t *doc) {moveCursor(doc, doc->cursor+1);}
+void action_copy(struct View *view) {copyToClipboardFrom(view);}
+void action_paste(struct View *view) {copyFromClipboardTo(view);}
+void action_cut(struct View *view) {copyToClipboardFrom(view); insert(view, "", 0);}
 
-void action_selectUp(doc_t *doc) {
-	moveSelection(doc, moveLineUp(doc->data, doc->selection, doc->length));
+void action_undo(struct View *view) {
+	long at = undo(view->document);
+	if (at >= 0) view->cursor = view->selection = at;
 }
-void action_cursorUp(doc_t *doc) {
-	moveCursor(doc, moveLineUp(doc->data, doc->cursor, doc->length));
+void action_redo(struct View *view) {
+	long at = redo(view->document);
+	if (at >= 0) view->cursor = view->selection = at;
 }
-void action_selectDown(doc_t *doc) {
-	moveSelection(doc, moveLineDown(doc->data, doc->selection, doc->length));
+
+void action_save(struct View *view) {
+	doc_t *document = view->document;
+	if (trace_replaying() || !document->path) return;
+	if (document->loading.active) showStatus("still loading");
+	else if (document->following.dropped) showStatus("not saved, its start was dropped");
+	else if (cutShort(document)) showStatus("not saved, cut short on disk");
+	else {
+		//writing over the file changes the text served and searched where it still comes from the mapping
+		if (savesInPlace(document)) {
+			if (connection) clipboard_keep();
+			if (finding && finding->document == document) search_stop();
+		}
+		if (!save(document)) showStatus("save failed");
+	}
 }
-void action_cursorDown(doc_t *doc) {
-	moveCursor(doc, moveLineDown(doc->data, doc->cursor, doc->length));
+
+void action_reload(struct View *view) {
+	reloadDocument(view->document);
+	showStatus(NULL);
 }
 
-void action_backspace(doc_t *doc) {
-	if (doc->cursor == doc->selection) moveSelection(doc, doc->selection-1);
-	insert(doc, "", 0);
+void action_selectLeft(struct View *view) {moveSelection(view, view->selection-1);}
+void action_cursorLeft(struct View *view) {moveCursor(view, view->cursor-1);}
+void action_selectRight(struct View *view) {moveSelection(view, view->selection+1);}
+void action_cursorRight(struct View *view) {moveCursor(view, view->cursor+1);}
+
+void action_selectUp(struct View *view) {
+	moveSelection(view, moveLineUp(view, view->selection));
+}
+void action_cursorUp(struct View *view) {
+	moveCursor(view, moveLineUp(view, view->cursor));
+}
+void action_selectDown(struct View *view) {
+	moveSelection(view, moveLineDown(view, view->selection));
+}
+void action_cursorDown(struct View *view) {
+	moveCursor(view, moveLineDown(view, view->cursor));
 }
 
-void action_newline(doc_t *doc) {
-	int where = doc->cursor < doc->selection ? doc->cursor : doc->selection;
-	where = startOfLine(doc->data, where);
-	insert(doc, "\n", 1);
-	insert(doc, doc->data+where, findWhitespaceFrom(doc->data, where));
+void action_backspace(struct View *view) {
+	if (view->cursor == view->selection) moveSelection(view, view->selection-1);
+	insert(view, "", 0);
 }
 
-void action_tab(doc_t *document) {
-	insert(document, "\t", 1);
+void action_newline(struct View *view) {
+	doc_t *doc = view->document;
+	long where = view->cursor < view->selection ? view->cursor : view->selection;
+	where = lineStart(doc, lineOf(doc, where));
+	long length = findWhitespaceFrom(doc, where);
+	char *indent = malloc(length);
+	if (indent) copyOut(doc, where, where+length, indent);
+	insert(view, "\n", 1);
+	if (indent && length > 0) {
+		joinEdits(doc);
+		insert(view, indent, length);
+	}
+	free(indent);
 }
-doc_t *load(doc_t *document, char *path) {
-	if (!document) document = calloc(1,sizeof(doc_t));
-	document->scroll = 0;
-	document->cursor = 0;
-	document->selection = 0;
-	if (document) {
-		if (!path && !document->path) {
-			if (lengthen(document, strlen(defaultstr))) {
-				memcpy(document->data, defaultstr, strlen(defaultstr));
-				return document;
-			}
-		} else {
-			if (!document->path) document->path = path;
-			FILE *file = fopen(document->path, "r");
-			if (file) {
-				fseek(file, 0, SEEK_END);
-				if (lengthen(document, ftell(file))) {
-					rewind(file);
-					fread(
-						document->data, sizeof(char),
-						document->length, file
-					);
-					fclose(file);
-				}
-			} else if (!lengthen(document, 0)) {
-				die("Unable to create document!");
-			}
-			return document;
+
+void action_tab(struct View *view) {
+	insert(view, "\t", 1);
+}
+
+#ifdef STATS
+void action_toggleStats(struct View *view) {(void) view; showStats = !showStats;}
+#endif
+
+void action_goToLine(struct View *view) {
+	(void) view;
+	openPrompt("line: ", goToLine, NULL);
+}
+
+void action_find(struct View *view) {
+	struct Prompt *prompt = &current->prompt;
+	if (prompt->action == findDone) {
+		long from = view->cursor > view->selection ? view->cursor : view->selection;
+		long found = search_next(view->document, prompt->text, prompt->length, from, SEARCH_NEAR);
+		if (found < 0) found = search_first(view->document, from);
+		findOrigin = found < 0 ? from : found;
+		findPending = found == SEARCH_UNKNOWN;
+		if (found < 0) return;
+		moveCursor(view, found);
+		moveSelection(view, found + prompt->length);
+		return;
+	}
+	if (finding && finding != current && finding->prompt.action == findDone) {
+		search_stop();
+		finding->prompt.action = NULL;
+		finding->panes[finding->focus]->redraw = true;
+	}
+	finding = current;
+	findPending = false;
+	findOrigin = view->cursor < view->selection ? view->cursor : view->selection;
+	snprintf(findLabel, sizeof(findLabel), "find: ");
+	openPrompt(findLabel, findDone, findChanged);
+}
+
+void action_replace(struct View *view) {
+	(void) view;
+	current->replacingRegex = false;
+	openPrompt("replace: ", replaceWith, NULL);
+}
+void action_replaceRegex(struct View *view) {
+	(void) view;
+	current->replacingRegex = true;
+	openPrompt("replace regex: ", replaceWith, NULL);
+}
+
+void action_split(struct View *view) {
+	if (current->height / (current->count+1) < 2*lineheight) return;
+	if (addPane(current, current->focus+1, view)) tile(current);
+}
+
+void action_unsplit(struct View *view) {
+	(void) view;
+	for (int k = 0; k < current->count; k++) current->panes[k]->closing = k != current->focus;
+}
+
+void action_closeView(struct View *view) {
+	(void) view;
+	current->panes[current->focus]->closing = true;
+}
+
+void action_otherView(struct View *view) {
+	(void) view;
+	focusPane((current->focus + 1) % current->count);
+}
+
+void action_newWindow(struct View *view) {
+	openWindow(view->document, current->width, current->height);
+}
+
+void action_follow(struct View *view) {
+	doc_t *document = view->document;
+	if (document->following.active) {
+		stopFollowing(document);
+		showStatus(NULL);
+	} else if (startFollowing(document, followLimit)) {
+		pinToEnd(current->panes[current->focus]);
+		showStatus("following");
+	} else showStatus("can't follow");
+}
+
+void openPrompt(char *label, void (*action)(struct View *, char *), void (*changed)(struct View *, char *)) {
+	struct Prompt *prompt = &current->prompt;
+	if (prompt->action == findDone) findDone(NULL, NULL);
+	prompt->label = label;
+	prompt->length = 0;
+	prompt->text[0] = 0;
+	prompt->action = action;
+	prompt->changed = changed;
+}
+
+void promptKey(struct View *view, xcb_keysym_t keysym, bool shift) {
+	struct Prompt *prompt = &current->prompt;
+	int length = prompt->length;
+	if (keysym >= XK_space && keysym <= XK_asciitilde) {
+		if (prompt->length < (int) sizeof(prompt->text) - 1) {
+			prompt->text[prompt->length++] = shift ? asciiupper(keysym) : (char) keysym;
 		}
+	} else if (keysym == XK_BackSpace) {
+		if (prompt->length > 0) prompt->length--;
+	} else if (keysym == XK_Return) {
+		void (*action)(struct View *, char *) = prompt->action;
+		prompt->text[prompt->length] = 0;
+		prompt->action = NULL;
+		action(view, prompt->text);
+	} else if (keysym == XK_Escape) {
+		void (*action)(struct View *, char *) = prompt->action;
+		prompt->action = NULL;
+		if (prompt->changed) prompt->changed(view, "");
+		if (action == findDone) findDone(view, NULL);
+	}
+	if (prompt->action && prompt->changed && prompt->length != length) {
+		prompt->text[prompt->length] = 0;
+		prompt->changed(view, prompt->text);
 	}
-	die("Unable to create document!");
-	return NULL;
 }
 
-void save(doc_t *document) {
-	if (!document->path) return;
-	FILE *file = fopen(document->path, "w");
-	if (!file) return;
-	fwrite(document->data, sizeof(char), document->length, file);
-	fclose(file);
+void goToLine(struct View *view, char *text) {
+	long line = strtol(text, NULL, 10);
+	if (line > 0) moveCursor(view, lineStart(view->document, line-1));
 }
 
-int lengthen(doc_t *document, int length) {
-	document->length += length;
-	if (document->length > document->size) {
-		document->size = (document->length + 4095) & ~4095;
-		document->data = realloc(document->data, document->size);
-		if (!document->data) return 0;
-	} else if (document->size == 0 || !document->data) {
-		document->size = 4096;
-		document->data = realloc(document->data, document->size);
-		if (!document->data) return 0;
+void findChanged(struct View *view, char *text) {
+	int length = strlen(text);
+	search_start(view->document, text, length);
+	long found = search_next(view->document, text, length, findOrigin, SEARCH_NEAR);
+	findPending = found < 0 && length > 0;
+	if (found < 0) {
+		found = findOrigin;
+		length = 0;
 	}
-	return document->size;
+	moveCursor(view, found);
+	moveSelection(view, found + length);
 }
 
-void moveCursor(doc_t *document, int where) {
+void replaceWith(struct View *view, char *text) {
+	(void) view;
+	if (!*text) return;
+	strcpy(current->replacing, text);
+	openPrompt("with: ", replaceAll, NULL);
+}
+
+void replaceAll(struct View *view, char *text) {
+	long count = search_replace(view->document, current->replacing, text, current->replacingRegex);
+	if (count < 0) {
+		showStatus(current->replacingRegex ? "bad pattern" : "replace failed");
+		return;
+	}
+	char status[32];
+	snprintf(status, sizeof(status), "%ld replaced", count);
+	showStatus(status);
+	view->scrollOffset = 0;
+}
+
+void findDone(struct View *view, char *text) {
+	(void) view;
+	(void) text;
+	search_stop();
+	finding = NULL;
+	findPending = false;
+}
+void moveCursor(struct View *view, long where) {
 	if (where < 0) where = 0;
-	else if (where > document->length) where = document->length;
-	document->selection = where;
-	document->cursor = where;
+	else if (where > view->document->length) where = view->document->length;
+	view->selection = where;
+	view->cursor = where;
 }
 
-void moveSelection(doc_t *document, int where) {
+void moveSelection(struct View *view, long where) {
 	if (where < 0) where = 0;
-	else if (where > document->length) where = document->length;
-	document->selection = where;
+	else if (where > view->document->length) where = view->document->length;
+	view->selection = where;
 }
 
-void insert(doc_t *document, char *data, int length) {
-	if (document->cursor != document->selection) {
-		doDeleteAction(document, document->cursor, document->selection);
+void insert(struct View *view, char *data, long length) {
+	doc_t *document = view->document;
+	if (view->cursor != view->selection) {
+		doDeleteAction(document, view->cursor, view->selection);
+		if (length > 0) joinEdits(document);
 	}
 	if (data && length > 0) {
-		doInsertAction(document, document->cursor, length, data);
+		doInsertAction(document, view->cursor, length, data);
 	}
 }
 
-void doInsertAction(doc_t *document, int where, int length, char *data) {
-	lengthen(document, length);
-	memmove(
-		document->data + where + length,
-		document->data + where,
-		document->length - where - length
-	);
-	memcpy(document->data + where, data, length);
-	if (document->cursor >= where) document->cursor += length;
-	if (document->selection >= where) document->selection += length;
-}
-
-void doDeleteAction(doc_t *document, int from, int to) {
-	int where = from < to ? from : to;
-	int length = from < to ? to-from : from-to;
-	memmove(
-		document->data + where,
-		document->data + where + length,
-		document->length - where - length
-	);
-	lengthen(document, -length);
-	if (document->cursor >= where+length) document->cursor -= length;
-	else if (document->cursor >= where) document->cursor = where;
-	if (document->selection >= where+length) document->selection -= length;
-	else if (document->selection >= where) document->selection = where;
-}
-
-void copyToClipboardFrom(doc_t *document) {
-	int from = document->cursor;
-	int to = document->selection;
-	clipboard_set(
-		document->data + (from < to ? from : to),
-		from < to ? to-from : from-to
-	);
+//copyToClipboardFrom: hands the clipboard the pieces of the selection rather than a copy of its text
+void copyToClipboardFrom(struct View *view) {
+	long from = view->cursor;
+	long to = view->selection;
+	long length = from < to ? to-from : from-to;
+	int count;
+	struct Piece *pieces = snapshot(view->document, from, to, &count);
+	if (!pieces) return;
+	if (connection) clipboard_set(pieces, count, length);
+	else free(pieces);
 }
 
-void copyFromClipboardTo(doc_t *document) {
-	char buffer[1024];
-	int length,offset=0;
-	do {
-		length = clipboard_get(buffer, 1024, offset);
-		offset += length;
-		if (length > 0) insert(document, buffer, length);
-	} while (length == 1024);
+void copyFromClipboardTo(struct View *view) {
+	if (trace_replaying()) {
+		char *data;
+		long length;
+		while ((data = trace_readPaste(&length))) {
+			insert(view, data, length);
+			free(data);
+		}
+		return;
+	}
+	long length;
+	char *text = clipboard_get(&length);
+	if (!text) return;
+	trace_write(&(struct TraceEvent) {.type = TRACE_PASTE, .value = length}, text);
+	insert(view, text, length);
+	free(text);
 }
 
-int findPositionIn(doc_t *document, int mx, int y) {
-	int x = 0;
-	char *d = document->data;
-	int i = document->scroll;
-	while (i < document->length && (
-		y >= lineheight || (y >= 0 && d[i]!='\n' && mx >= x + advance(d[i]))
-	)) {
-		x += advance(d[i]);
-		if (d[i] == '\n' || x >= winwidth) {
-			if (d[i] == '\n') i++;
-			y -= lineheight;
-			x = 0;
-		} else i++;
-	}
-	return i;
-}
-
-int isPositionOutsideBounds(doc_t *document, int p) {
-	int x = 0, y = 0;
-	char *d = document->data;
-	int i = document->scroll;
-	while (i < document->length && y < winheight && i != p) {
-		x += advance(d[i]);
-		if (d[i] == '\n' || x >= winwidth) {
-			if (d[i] == '\n') i++;
-			y += lineheight;
-			x = 0;
-		} else i++;
-	}
-	return i != p;
-}
-
-void scrollDown(doc_t *document) {
-	document->scroll = advanceSubline(document->data, document->scroll, document->length);
-}
-
-void scrollUp(doc_t *document) {
-	if (document->scroll == 0) return;
-	char *d = document->data;
-	int i = document->scroll;
-	int subline = getSubline(d, i);
-	i = startOfLine(d, i);
-	if (subline == 0) {
-		if (i > 0) {
-			subline = getSubline(d, i-1);
-			i = startOfLine(d, i-1);
-		}
-	} else subline--;
-	while (subline > 0) {
-		i = advanceSubline(d, i, document->length);
-		subline--;
-	}
-	document->scroll = i;
-}
-
-int moveLineUp(char *d, int i, int length) {
-	int old = i;
-	int subline = getSubline(d, i);
-	i = startOfLine(d, i);
-	int j = i, w = 0;
-	while (j < old) {
-		w += advance(d[j]);
-		if (w >= winwidth) w = 0;
-		else j++;
-	}
-	if (w + advance(d[j]) >= winwidth) w = 0;
-	if (subline == 0) {
-		if (i > 0) {
-			subline = getSubline(d, i-1);
-			i = startOfLine(d, i-1);
-		}
-	} else subline--;
-	while (subline > 0) {
-		i = advanceSubline(d, i, length);
-		subline--;
+void scrollBy(struct Pane *pane, int pixels) {
+	struct View *view = &pane->view;
+	int *offset = &view->scrollOffset;
+	*offset += pixels;
+	while (*offset >= lineheight) {
+		long row = nextRow(view, view->scroll);
+		if (row < 0) break;
+		view->scroll = row;
+		*offset -= lineheight;
 	}
-	int x = 0;
-	while (i < length && d[i] != '\n' && x < w) {
-		x += advance(d[i]);
-		if (x >= winwidth) {
-			x = 0;
-		} else i++;
+	while (*offset < 0) {
+		long row = previousRow(view, view->scroll);
+		if (row < 0) break;
+		view->scroll = row;
+		*offset += lineheight;
+	}
+	if (*offset < 0 || nextRow(view, view->scroll) < 0) {
+		*offset = 0;
+		pane->scrollPending = 0;
 	}
-	return i;
 }
 
-int moveLineDown(char *d, int i, int length) {
-	int old = i;
-	i = startOfLine(d, i);
+long moveLineUp(struct View *view, long i) {
 	int w = 0;
-	while (i < old) {
-		w += advance(d[i]);
-		if (w >= winwidth) w = 0;
-		else i++;
-	}
-	if (w + advance(d[i]) >= winwidth) w = 0;
-	int x = w;
-	do {
-		x += advance(d[i]);
-		if (d[i] == '\n' || x >= winwidth) {
-			if (d[i] == '\n') i++;
-			x = 0;
-		} else i++;
-	} while (x != 0);
-	while (i < length && d[i] != '\n' && x < w) {
-		x += advance(d[i]);
-		if (x >= winwidth) {
-			x = 0;
-		} else i++;
-	}
-	return i;
-}
-
-int getSubline(char *d, int i) {
-	int sublines = 0;
-	int x = 0;
-	if (d[i] == '\n') i--;
-	while (i > 0 && d[i] != '\n') {
-		x += advance(d[i]);
-		if (x >= winwidth) {
-			sublines++;
-			x = 0;
-		} else i--;
-	}
-	return sublines;
-}
-
-int startOfLine(char *d, int i) {
-	int x = 0;
-	if (d[i] == '\n') i--;
-	while (i >= 0 && d[i] != '\n') {
-		x += advance(d[i]);
-		if (x >= winwidth) {
-			x = 0;
-		} else i--;
-	}
-	return i+1;
-}
-
-int findWhitespaceFrom(char *d, int i) {
-	int old = i;
-	while (d[i] == '\t' || d[i] == ' ') i++;
-	return i-old;
+	for (long j = startOfRow(view, i); j < i; j++) w += advance(charAt(view->document, j));
+	long row = previousRow(view, i);
+	return row < 0 ? i : positionInRow(view, row, w);
 }
 
-int advanceSubline(char *d, int i, int length) {
-	int old = i;
-	int x = 0;
-	while (i < length && d[i] != '\n' && x + advance(d[i]) < winwidth) {
-		x += advance(d[i++]);
-	}
-	if (i >= length) return old;
-	else if (d[i] == '\n') return i+1;
-	else return i;
+long moveLineDown(struct View *view, long i) {
+	int w = 0;
+	for (long j = startOfRow(view, i); j < i; j++) w += advance(charAt(view->document, j));
+	long row = nextRow(view, i);
+	return row < 0 ? view->document->length : positionInRow(view, row, w);
+}
+
+int findWhitespaceFrom(doc_t *document, long i) {
+	long old = i;
+	while (charAt(document, i) == '\t' || charAt(document, i) == ' ') i++;
+	return i-old;
 }
 
 char asciiupper(char c) {
@@ -752,19 +1336,32 @@ char asciiupper(char c) {
 	}
 }
 
-void setColor(uint32_t fg, uint32_t bg) {
-	xcb_change_gc(
-		connection, graphics,
-		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND,
-		(uint32_t[]) {fg, bg}
+void loadFontMetrics(xcb_font_t font, xcb_charinfo_t *metrics) {
+	xcb_query_font_reply_t *reply = xcb_query_font_reply(
+		connection, xcb_query_font(connection, font), NULL
 	);
+	if (!reply) die("Could not open the font!");
+	lineoffset = reply->font_ascent;
+	lineheight = reply->font_ascent + reply->font_descent;
+	
+	//the first row of the font is all PolyText8 can reach
+	xcb_charinfo_t *infos = xcb_query_font_char_infos(reply);
+	int count = xcb_query_font_char_infos_length(reply);
+	for (int c = 0x20; c < 0x7F; c++) {
+		int k = c - reply->min_char_or_byte2;
+		bool exists = reply->min_byte1 == 0 && k >= 0 && k < count && c <= reply->max_char_or_byte2;
+		metrics[c-0x20] = count == 0 ? reply->max_bounds : exists ? infos[k] : reply->min_bounds;
+		advanceLookupTable[c-0x20] = metrics[c-0x20].character_width;
+	}
+	free(reply);
 }
 
-void msleep(unsigned long ms) {
-	struct timespec ts;
-	ts.tv_sec = ms / 1000;
-	ts.tv_nsec = (ms % 1000) * 1000000;
-	nanosleep(&ts, &ts);
+long sizeOf(const char *text) {
+	char *end;
+	long size = strtol(text, &end, 10);
+	int shift = !*end ? 0 : !strcmp(end, "k") ? 10 : !strcmp(end, "m") ? 20 : !strcmp(end, "g") ? 30 : -1;
+	if (end == text || size < 0 || shift < 0 || size > LONG_MAX >> shift) return -1;
+	return size << shift;
 }
 
 void die(char *msg) {
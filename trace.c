@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+//trace: records the input texi handles and replays it, timing each event from dispatch to the flush
+//of its frame so that slow cases can be reproduced and builds compared
+
+#define TRACE_MAGIC "texitrc1"
+
+//a headless replay lays out text with the metrics it was recorded with, so that it wraps the same
+struct TraceHeader {
+	char magic[8];
+	uint16_t width, height;
+	uint16_t lineoffset, lineheight;
+	uint16_t advances[95];
+};
+
+static FILE *file;
+static bool replaying = false;
+static double started;
+
+//read ahead while looking for a paste
+static struct TraceEvent next;
+static bool peeked = false;
+
+//when each event was dispatched, then how long it took once its frame was flushed
+static struct {
+	double *times;
+	int count, capacity, flushed;
+	bool active;
+} latencies;
+
+static int compareTimes(const void *a, const void *b);
+
+bool trace_record(char *path, int width, int height) {
+	file = fopen(path, "wb");
+	if (!file) return false;
+	struct TraceHeader header = {
+		.magic = TRACE_MAGIC, .width = width, .height = height,
+		.lineoffset = lineoffset, .lineheight = lineheight
+	};
+	memcpy(header.advances, advanceLookupTable, sizeof(header.advances));
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	started = now();
+	latencies.active = true;
+	return true;
+}
+
+bool trace_replay(char *path, bool metrics, int *width, int *height) {
+	struct TraceHeader header;
+	file = fopen(path, "rb");
+	if (!file) return false;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 8)) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	if (metrics) {
+		lineoffset = header.lineoffset;
+		lineheight = header.lineheight;
+		*width = header.width;
+		*height = header.height;
+		memcpy(advanceLookupTable, header.advances, sizeof(header.advances));
+	}
+	replaying = true;
+	latencies.active = true;
+	return true;
+}
+
+bool trace_replaying() {
+	return replaying;
+}
+
+void trace_write(struct TraceEvent *event, const char *data) {
+	if (!file || replaying) return;
+	event->time = (now() - started) * 1000;
+	fwrite(event, sizeof(*event), 1, file);
+	if (event->type == TRACE_PASTE) fwrite(data, 1, event->value, file);
+}
+
+bool trace_read(struct TraceEvent *event) {
+	if (!replaying) return false;
+	for (;;) {
+		if (peeked) {
+			*event = next;
+			peeked = false;
+		} else if (fread(event, sizeof(*event), 1, file) != 1) {
+			return false;
+		}
+		if (event->type != TRACE_PASTE) return true;
+		//a paste whose key wasn't replayed, which can't happen with traces written by texi
+		if (fseek(file, event->value, SEEK_CUR)) return false;
+	}
+}
+
+char *trace_readPaste(long *length) {
+	if (!peeked) peeked = fread(&next, sizeof(next), 1, file) == 1;
+	if (!peeked || next.type != TRACE_PASTE) return NULL;
+	peeked = false;
+	char *data = malloc(next.value ? next.value : 1);
+	if (!data) return NULL;
+	if (fread(data, 1, next.value, file) != next.value) {
+		free(data);
+		return NULL;
+	}
+	*length = next.value;
+	return data;
+}
+
+void trace_finish() {
+	if (file) fclose(file);
+	file = NULL;
+	replaying = false;
+}
+
+void trace_dispatched() {
+	if (!latencies.active) return;
+	if (latencies.count == latencies.capacity) {
+		int capacity = latencies.capacity ? latencies.capacity*2 : 1024;
+		double *times = realloc(latencies.times, capacity * sizeof(double));
+		if (!times) return;
+		latencies.times = times;
+		latencies.capacity = capacity;
+	}
+	latencies.times[latencies.count++] = now();
+}
+
+void trace_flushed() {
+	if (!latencies.active || latencies.flushed == latencies.count) return;
+	double time = now();
+	for (; latencies.flushed < latencies.count; latencies.flushed++) {
+		latencies.times[latencies.flushed] = time - latencies.times[latencies.flushed];
+	}
+}
+
+void trace_report() {
+	int count = latencies.flushed;
+	if (!count) return;
+	qsort(latencies.times, count, sizeof(double), compareTimes);
+	fprintf(
+		stderr, "%d events, dispatch to flush p50 %.3fms p99 %.3fms max %.3fms\n", count,
+		latencies.times[count/2] * 1000, latencies.times[count*99/100] * 1000,
+		latencies.times[count-1] * 1000
+	);
+}
+
+static int compareTimes(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
@@ -0,0 +1,32 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "render.h"
+
+enum TraceType {TRACE_KEY, TRACE_BUTTON_PRESS, TRACE_BUTTON_RELEASE, TRACE_RESIZE, TRACE_CLOSE, TRACE_PASTE};
+
+//a paste is followed by value bytes of the text that the clipboard gave
+struct TraceEvent {
+	uint32_t time; //milliseconds since recording started
+	uint8_t type, detail;
+	uint16_t state;
+	int16_t x, y;
+	uint32_t value;
+};
+
+bool trace_record(char *path, int width, int height);
+bool trace_replay(char *path, bool metrics, int *width, int *height);
+bool trace_replaying();
+void trace_write(struct TraceEvent *event, const char *data);
+bool trace_read(struct TraceEvent *event);
+char *trace_readPaste(long *length);
+void trace_finish();
+
+void trace_dispatched();
+void trace_flushed();
+void trace_report();
+
+#endif
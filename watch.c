@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+
+//watch: the directories of the open files are watched rather than the files, as most programs
+//that rewrite a file, texi included, write a new one and rename it over the old
+
+struct Watched {
+	char *path;
+	const char *name;
+	int directory;
+	bool changed;
+	struct Watched *next;
+};
+
+static int events = -1;
+static struct Watched *watched;
+
+static struct Watched *find(const char *path);
+
+int watch_start() {
+	events = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	return events;
+}
+
+void watch_file(const char *path) {
+	if (events < 0 || find(path)) return;
+	struct Watched *file = malloc(sizeof(struct Watched));
+	char *copy = malloc(strlen(path) + 1);
+	char *slash = strrchr(path, '/');
+	char *directory = malloc(slash ? slash - path + 2 : 2);
+	if (!file || !copy || !directory) {
+		free(file);
+		free(copy);
+		free(directory);
+		return;
+	}
+	strcpy(copy, path);
+	if (!slash) strcpy(directory, ".");
+	else {
+		memcpy(directory, path, slash > path ? slash - path : 1);
+		directory[slash > path ? slash - path : 1] = 0;
+	}
+	file->directory = inotify_add_watch(
+		events, directory, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO
+	);
+	free(directory);
+	if (file->directory < 0) {
+		free(file);
+		free(copy);
+		return;
+	}
+	file->path = copy;
+	file->name = slash ? copy + (slash - path) + 1 : copy;
+	file->changed = false;
+	file->next = watched;
+	watched = file;
+}
+
+void watch_forget(const char *path) {
+	struct Watched **link = &watched;
+	while (*link && strcmp((*link)->path, path)) link = &(*link)->next;
+	struct Watched *file = *link;
+	if (!file) return;
+	*link = file->next;
+	bool shared = false;
+	for (struct Watched *other = watched; other; other = other->next) shared |= other->directory == file->directory;
+	if (!shared) inotify_rm_watch(events, file->directory);
+	free(file->path);
+	free(file);
+}
+
+void watch_read() {
+	//the union keeps the buffer aligned for the events read into it
+	union {
+		struct inotify_event event;
+		char bytes[4096];
+	} buffer;
+	for (;;) {
+		ssize_t length = read(events, buffer.bytes, sizeof(buffer));
+		if (length < 0 && errno == EINTR) continue;
+		if (length <= 0) return;
+		for (char *at = buffer.bytes; at < buffer.bytes + length;) {
+			struct inotify_event *event = (struct inotify_event *) at;
+			for (struct Watched *file = watched; file; file = file->next) {
+				if (file->directory == event->wd && event->len && !strcmp(file->name, event->name)) {
+					file->changed = true;
+				}
+			}
+			at += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+bool watch_changed(const char *path) {
+	struct Watched *file = find(path);
+	return file && file->changed;
+}
+
+void watch_seen(const char *path) {
+	struct Watched *file = find(path);
+	if (file) file->changed = false;
+}
+
+void watch_stop() {
+	while (watched) watch_forget(watched->path);
+	if (events >= 0) close(events);
+	events = -1;
+}
+
+static struct Watched *find(const char *path) {
+	struct Watched *file = watched;
+	while (file && strcmp(file->path, path)) file = file->next;
+	return file;
+}
@@ -0,0 +1,14 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+int watch_start();
+void watch_file(const char *path);
+void watch_forget(const char *path);
+void watch_read();
+bool watch_changed(const char *path);
+void watch_seen(const char *path);
+void watch_stop();
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdlib.h>
+
+#include "xcore.h"
+#include "layout.h"
+#include "stats.h"
+
+static xcb_connection_t *connection;
+static xcb_gcontext_t graphics;
+static uint8_t depth;
+
+//frames are drawn into a pixmap per window on the server
+static struct Canvas {
+	xcb_window_t window;
+	xcb_pixmap_t pixmap;
+	int width, height;
+	struct Canvas *next;
+} *canvases, *current;
+
+static void setColor(uint32_t color);
+
+void xcore_init(xcb_connection_t *c, xcb_gcontext_t gc, uint8_t d) {
+	connection = c;
+	graphics = gc;
+	depth = d;
+}
+
+bool xcore_use(uint32_t window) {
+	if (current && current->window == window) return true;
+	for (current = canvases; current; current = current->next) {
+		if (current->window == window) return true;
+	}
+	current = calloc(1, sizeof(struct Canvas));
+	if (!current) return false;
+	current->window = window;
+	current->next = canvases;
+	canvases = current;
+	return true;
+}
+
+void xcore_forget(uint32_t window) {
+	for (struct Canvas **link = &canvases; *link; link = &(*link)->next) {
+		struct Canvas *canvas = *link;
+		if (canvas->window != window) continue;
+		if (canvas->pixmap) xcb_free_pixmap(connection, canvas->pixmap);
+		*link = canvas->next;
+		if (current == canvas) current = NULL;
+		free(canvas);
+		return;
+	}
+}
+
+xcb_pixmap_t xcore_canvas() {
+	return current->pixmap;
+}
+
+bool xcore_resize(int w, int h) {
+	if (current->pixmap) xcb_free_pixmap(connection, current->pixmap);
+	current->pixmap = xcb_generate_id(connection);
+	xcb_create_pixmap(connection, depth, current->pixmap, current->window, w, h);
+	current->width = w;
+	current->height = h;
+	return true;
+}
+
+void xcore_fill(int x, int y, int w, int h, uint32_t color) {
+	setColor(color);
+	STAT(requests, 1);
+	xcb_poly_fill_rectangle(
+		connection, current->pixmap, graphics, 1,
+		(const xcb_rectangle_t[]) {{x, y, w, h}}
+	);
+}
+
+//xcore_text: a single PolyText8 request per 255 or so characters, tabs become the delta of the next item
+int xcore_text(const char *s, int length, int x, int y, uint32_t color) {
+	uint8_t items[512];
+	int used = 0, item = -1, delta = 0, origin = x;
+	setColor(color);
+	for (int i = 0; i < length; i++) {
+		char c = s[i];
+		if (c == '\t') {
+			x += advance(c);
+			delta += advance(c);
+			continue;
+		}
+		if (used + 8 + 2*(delta/127) > (int) sizeof(items)) {
+			xcb_poly_text_8(connection, current->pixmap, graphics, origin, y, used, items);
+			STAT(requests, 1);
+			origin = x - delta;
+			used = 0;
+			item = -1;
+		}
+		if (item < 0 || delta > 0 || items[item] > 250) {
+			for (; delta > 127; delta -= 127) {
+				items[used++] = 0;
+				items[used++] = 127;
+			}
+			item = used;
+			items[used++] = 0;
+			items[used++] = delta;
+			delta = 0;
+		}
+		if (c >= 0x20 && c < 0x7F) {
+			items[used++] = c;
+			items[item] += 1;
+		} else {
+			items[used++] = '[';
+			items[used++] = hexdigit(((unsigned char)c)<<4);
+			items[used++] = hexdigit(c);
+			items[used++] = ']';
+			items[item] += 4;
+		}
+		x += advance(c);
+	}
+	if (used) {
+		xcb_poly_text_8(connection, current->pixmap, graphics, origin, y, used, items);
+		STAT(requests, 1);
+	}
+	return x - origin;
+}
+
+void xcore_shift(int dy) {
+	STAT(requests, 1);
+	xcb_copy_area(
+		connection, current->pixmap, current->pixmap, graphics,
+		0, dy > 0 ? dy : 0, 0, dy > 0 ? 0 : -dy, current->width, current->height - abs(dy)
+	);
+}
+
+void xcore_present(int y, int h) {
+	STAT(requests, 1);
+	xcb_copy_area(
+		connection, current->pixmap, current->window, graphics, 0, y, 0, y, current->width, h
+	);
+}
+
+static void setColor(uint32_t color) {
+	static uint32_t current;
+	static bool set = false;
+	if (set && color == current) return;
+	set = true;
+	current = color;
+	STAT(requests, 1);
+	xcb_change_gc(connection, graphics, XCB_GC_FOREGROUND, (uint32_t[]) {color});
+}
@@ -0,0 +1,18 @@
+#ifndef XCORE_H
+#define XCORE_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+void xcore_init(xcb_connection_t *, xcb_gcontext_t, uint8_t depth);
+bool xcore_use(uint32_t window);
+void xcore_forget(uint32_t window);
+xcb_pixmap_t xcore_canvas();
+bool xcore_resize(int width, int height);
+void xcore_fill(int x, int y, int width, int height, uint32_t color);
+int xcore_text(const char *s, int length, int x, int y, uint32_t color);
+void xcore_shift(int dy);
+void xcore_present(int y, int height);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <xcb/render.h>
+
+#include "xrender.h"
+#include "atlas.h"
+#include "layout.h"
+#include "stats.h"
+
+#define BRUSHES 4
+
+static xcb_connection_t *connection;
+static xcb_render_pictformat_t alphaFormat, visualFormat;
+static xcb_render_glyphset_t glyphset;
+static xcb_render_picture_t target;
+static xcb_drawable_t targeted;
+
+static struct Brush {
+	uint32_t pixel;
+	xcb_render_picture_t picture;
+} brushes[BRUSHES];
+static int brushCount;
+
+static bool findFormats(xcb_screen_t *screen);
+static bool createBrushes(xcb_screen_t *screen, uint32_t *colors, int count);
+static bool uploadGlyphs(xcb_screen_t *screen, xcb_font_t font, xcb_charinfo_t *metrics, int ascent, int descent);
+static xcb_render_picture_t brushFor(uint32_t color);
+
+//xrender_init: uploads the glyphs once, returns false if the server can't take them, so core text is used
+bool xrender_init(
+	xcb_connection_t *c, xcb_screen_t *screen, xcb_font_t font,
+	xcb_charinfo_t *metrics, int ascent, int descent,
+	uint32_t *colors, int count
+) {
+	connection = c;
+	const xcb_query_extension_reply_t *extension = xcb_get_extension_data(connection, &xcb_render_id);
+	if (!extension || !extension->present) return false;
+	xcb_render_query_version_reply_t *version = xcb_render_query_version_reply(
+		connection, xcb_render_query_version(connection, 0, 10), NULL
+	);
+	if (!version) return false;
+	bool solidFills = version->major_version > 0 || version->minor_version >= 10;
+	free(version);
+	return solidFills
+		&& findFormats(screen)
+		&& createBrushes(screen, colors, count)
+		&& uploadGlyphs(screen, font, metrics, ascent, descent);
+}
+
+void xrender_target(xcb_drawable_t drawable) {
+	if (target && drawable == targeted) return;
+	if (target) xcb_render_free_picture(connection, target);
+	targeted = drawable;
+	target = xcb_generate_id(connection);
+	xcb_render_create_picture(connection, target, drawable, visualFormat, 0, NULL);
+}
+
+//xrender_text: glyphs go in elements of up to 254, the first element of a request is placed absolutely
+int xrender_text(const char *s, int length, int x, int y, uint32_t color) {
+	uint8_t cmds[1024];
+	int used = 0, elt = -1, pen = x, origin = x;
+	for (int i = 0; i < length; i++) {
+		char c = s[i];
+		if (c == '\t') {
+			x += advance(c);
+			continue;
+		}
+		uint8_t glyphs[4];
+		int n = 0;
+		if (c >= 0x20 && c < 0x7F) {
+			glyphs[n++] = c;
+		} else {
+			glyphs[n++] = '[';
+			glyphs[n++] = hexdigit(((unsigned char)c)<<4);
+			glyphs[n++] = hexdigit(c);
+			glyphs[n++] = ']';
+		}
+		if (used + 12 + n > (int) sizeof(cmds)) {
+			while (used & 3) cmds[used++] = 0;
+			xcb_render_composite_glyphs_8(
+				connection, XCB_RENDER_PICT_OP_OVER, brushFor(color), target,
+				0, glyphset, 0, 0, used, cmds
+			);
+			STAT(requests, 1);
+			used = 0;
+			elt = -1;
+		}
+		if (elt < 0 || x != pen || cmds[elt] + n > 254) {
+			while (used & 3) cmds[used++] = 0;
+			int16_t delta[2] = {used ? x - pen : x, used ? 0 : y};
+			elt = used;
+			memset(cmds + used, 0, 4);
+			memcpy(cmds + used + 4, delta, sizeof(delta));
+			used += 8;
+		}
+		memcpy(cmds + used, glyphs, n);
+		used += n;
+		cmds[elt] += n;
+		x += advance(c);
+		pen = x;
+	}
+	if (used) {
+		while (used & 3) cmds[used++] = 0;
+		xcb_render_composite_glyphs_8(
+			connection, XCB_RENDER_PICT_OP_OVER, brushFor(color), target,
+			0, glyphset, 0, 0, used, cmds
+		);
+		STAT(requests, 1);
+	}
+	return x - origin;
+}
+
+static bool findFormats(xcb_screen_t *screen) {
+	xcb_render_query_pict_formats_reply_t *formats = xcb_render_query_pict_formats_reply(
+		connection, xcb_render_query_pict_formats(connection), NULL
+	);
+	if (!formats) return false;
+	xcb_render_pictforminfo_iterator_t format = xcb_render_query_pict_formats_formats_iterator(formats);
+	for (; format.rem; xcb_render_pictforminfo_next(&format)) {
+		if (
+			format.data->type == XCB_RENDER_PICT_TYPE_DIRECT && format.data->depth == 8
+			&& format.data->direct.alpha_mask == 0xff && !format.data->direct.red_mask
+		) alphaFormat = format.data->id;
+	}
+	xcb_render_pictscreen_iterator_t pictscreen = xcb_render_query_pict_formats_screens_iterator(formats);
+	for (; pictscreen.rem; xcb_render_pictscreen_next(&pictscreen)) {
+		xcb_render_pictdepth_iterator_t depth = xcb_render_pictscreen_depths_iterator(pictscreen.data);
+		for (; depth.rem; xcb_render_pictdepth_next(&depth)) {
+			xcb_render_pictvisual_iterator_t visual = xcb_render_pictdepth_visuals_iterator(depth.data);
+			for (; visual.rem; xcb_render_pictvisual_next(&visual)) {
+				if (visual.data->visual == screen->root_visual) visualFormat = visual.data->format;
+			}
+		}
+	}
+	free(formats);
+	return alphaFormat && visualFormat;
+}
+
+static bool createBrushes(xcb_screen_t *screen, uint32_t *colors, int count) {
+	if (count > BRUSHES) count = BRUSHES;
+	xcb_query_colors_reply_t *reply = xcb_query_colors_reply(
+		connection, xcb_query_colors(connection, screen->default_colormap, count, colors), NULL
+	);
+	if (!reply) return false;
+	xcb_rgb_t *rgb = xcb_query_colors_colors(reply);
+	for (brushCount = 0; brushCount < count; brushCount++) {
+		struct Brush *brush = brushes + brushCount;
+		brush->pixel = colors[brushCount];
+		brush->picture = xcb_generate_id(connection);
+		xcb_render_create_solid_fill(connection, brush->picture, (xcb_render_color_t) {
+			rgb[brushCount].red, rgb[brushCount].green, rgb[brushCount].blue, 0xffff
+		});
+	}
+	free(reply);
+	return true;
+}
+
+static bool uploadGlyphs(xcb_screen_t *screen, xcb_font_t font, xcb_charinfo_t *metrics, int ascent, int descent) {
+	struct Atlas atlas;
+	if (!atlas_capture(connection, screen, font, metrics, ascent, descent, &atlas)) return false;
+	int height = atlas.height;
+	uint32_t ids[95];
+	xcb_render_glyphinfo_t glyphs[95];
+	uint8_t *data = calloc(95, ((atlas.pitch + 3) & ~3) * height);
+	if (!data) {
+		atlas_free(&atlas);
+		return false;
+	}
+	long used = 0;
+	for (int k = 0; k < 95; k++) {
+		int bearing = metrics[k].left_side_bearing;
+		int glyphWidth = metrics[k].right_side_bearing - bearing;
+		if (glyphWidth < 1) glyphWidth = 1;
+		ids[k] = 0x20 + k;
+		glyphs[k] = (xcb_render_glyphinfo_t) {
+			glyphWidth, height, -bearing, ascent, metrics[k].character_width, 0
+		};
+		for (int row = 0; row < height; row++) memcpy(
+			data + used + row*((glyphWidth + 3) & ~3),
+			atlas.pixels + row*atlas.stride + k*atlas.pitch - atlas.left + bearing, glyphWidth
+		);
+		used += ((glyphWidth + 3) & ~3) * height;
+	}
+	atlas_free(&atlas);
+	
+	glyphset = xcb_generate_id(connection);
+	xcb_render_create_glyph_set(connection, glyphset, alphaFormat);
+	xcb_render_add_glyphs(connection, glyphset, 95, ids, glyphs, used, data);
+	free(data);
+	return true;
+}
+
+static xcb_render_picture_t brushFor(uint32_t color) {
+	for (int k = 0; k < brushCount; k++) if (brushes[k].pixel == color) return brushes[k].picture;
+	return brushes[0].picture;
+}
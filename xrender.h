@@ -0,0 +1,16 @@
+#ifndef XRENDER_H
+#define XRENDER_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+bool xrender_init(
+	xcb_connection_t *, xcb_screen_t *, xcb_font_t,
+	xcb_charinfo_t *metrics, int ascent, int descent,
+	uint32_t *colors, int count
+);
+void xrender_target(xcb_drawable_t drawable);
+int xrender_text(const char *s, int length, int x, int y, uint32_t color);
+
+#endif
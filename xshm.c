@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+
+#include "xshm.h"
+#include "atlas.h"
+#include "layout.h"
+#include "stats.h"
+
+static xcb_connection_t *connection;
+static xcb_gcontext_t graphics;
+static struct Atlas atlas;
+static uint8_t depth;
+
+//the server reads a segment when it gets to the request, so drawing has to wait for that
+static struct Image {
+	xcb_window_t window;
+	xcb_shm_seg_t segment;
+	uint32_t *pixels;
+	int width, height;
+	bool pending;
+	struct Image *next;
+} *images, *image;
+
+static void settle(struct Image *waiting);
+static void detach(struct Image *stale);
+static void blend(int k, int x, int y, uint32_t color);
+
+bool xshm_init(
+	xcb_connection_t *c, xcb_screen_t *screen, xcb_gcontext_t gc, xcb_font_t font,
+	xcb_charinfo_t *metrics, int ascent, int descent
+) {
+	connection = c;
+	graphics = gc;
+	const xcb_query_extension_reply_t *extension = xcb_get_extension_data(connection, &xcb_shm_id);
+	if (!extension || !extension->present) return false;
+	const xcb_setup_t *setup = xcb_get_setup(connection);
+	uint16_t probe = 1;
+	bool littleEndian = *(uint8_t *) &probe;
+	if (littleEndian != (setup->image_byte_order == XCB_IMAGE_ORDER_LSB_FIRST)) return false;
+	bool words = false;
+	xcb_format_iterator_t format = xcb_setup_pixmap_formats_iterator(setup);
+	for (; format.rem; xcb_format_next(&format)) {
+		if (format.data->depth == screen->root_depth) words = format.data->bits_per_pixel == 32;
+	}
+	if (!words) return false;
+	depth = screen->root_depth;
+	return atlas_capture(connection, screen, font, metrics, ascent, descent, &atlas);
+}
+
+bool xshm_use(uint32_t window) {
+	if (image && image->window == window) return true;
+	for (image = images; image; image = image->next) {
+		if (image->window == window) return true;
+	}
+	image = calloc(1, sizeof(struct Image));
+	if (!image) return false;
+	image->window = window;
+	image->next = images;
+	images = image;
+	return true;
+}
+
+void xshm_forget(uint32_t window) {
+	for (struct Image **link = &images; *link; link = &(*link)->next) {
+		struct Image *forgotten = *link;
+		if (forgotten->window != window) continue;
+		detach(forgotten);
+		*link = forgotten->next;
+		if (image == forgotten) image = NULL;
+		free(forgotten);
+		return;
+	}
+}
+
+bool xshm_resize(int width, int height) {
+	detach(image);
+	int id = shmget(IPC_PRIVATE, (size_t) width * height * sizeof(uint32_t), IPC_CREAT | 0600);
+	if (id < 0) return false;
+	void *pixels = shmat(id, NULL, 0);
+	if (pixels == (void *) -1) {
+		shmctl(id, IPC_RMID, NULL);
+		return false;
+	}
+	image->segment = xcb_generate_id(connection);
+	xcb_generic_error_t *error = xcb_request_check(
+		connection, xcb_shm_attach_checked(connection, image->segment, id, 1)
+	);
+	//marked for removal now, it goes away once both sides have detached
+	shmctl(id, IPC_RMID, NULL);
+	if (error) {
+		free(error);
+		shmdt(pixels);
+		return false;
+	}
+	image->pixels = pixels;
+	image->width = width;
+	image->height = height;
+	return true;
+}
+
+void xshm_fill(int x, int y, int width, int height, uint32_t color) {
+	settle(image);
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if (x + width > image->width) width = image->width - x;
+	if (y + height > image->height) height = image->height - y;
+	for (int row = y; row < y + height; row++) {
+		uint32_t *pixel = image->pixels + row*image->width + x;
+		for (int i = 0; i < width; i++) pixel[i] = color;
+	}
+}
+
+int xshm_text(const char *s, int length, int x, int y, uint32_t color) {
+	settle(image);
+	int origin = x;
+	for (int i = 0; i < length; i++) {
+		char c = s[i];
+		if (x < image->width && c >= 0x20 && c < 0x7F) {
+			blend(c - 0x20, x, y, color);
+		} else if (x < image->width && c != '\t') {
+			char escape[4] = {'[', hexdigit(((unsigned char)c)<<4), hexdigit(c), ']'};
+			for (int j = 0, pen = x; j < 4; pen += advance(escape[j++])) blend(escape[j] - 0x20, pen, y, color);
+		}
+		x += advance(c);
+	}
+	return x - origin;
+}
+
+void xshm_shift(int dy) {
+	settle(image);
+	int rows = image->height - abs(dy);
+	if (rows <= 0) return;
+	uint32_t *top = image->pixels, *moved = image->pixels + abs(dy)*image->width;
+	if (dy > 0) memmove(top, moved, (size_t) rows * image->width * sizeof(uint32_t));
+	else memmove(moved, top, (size_t) rows * image->width * sizeof(uint32_t));
+}
+
+void xshm_present(int y, int height) {
+	xcb_shm_put_image(
+		connection, image->window, graphics, image->width, image->height,
+		0, y, image->width, height, 0, y,
+		depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 0, image->segment, 0
+	);
+	image->pending = true;
+	STAT(requests, 1);
+}
+
+static void settle(struct Image *waiting) {
+	if (!waiting->pending) return;
+	free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), NULL));
+	STAT(requests, 1);
+	waiting->pending = false;
+}
+
+static void detach(struct Image *stale) {
+	if (!stale->pixels) return;
+	settle(stale);
+	xcb_shm_detach(connection, stale->segment);
+	shmdt(stale->pixels);
+	stale->pixels = NULL;
+}
+
+static void blend(int k, int x, int y, uint32_t color) {
+	int left = x + atlas.left, top = y - atlas.ascent;
+	if (left >= image->width || left + atlas.pitch <= 0) return;
+	for (int row = 0; row < atlas.height; row++) {
+		if (top + row < 0 || top + row >= image->height) continue;
+		const uint8_t *coverage = atlas.pixels + row*atlas.stride + k*atlas.pitch;
+		uint32_t *pixel = image->pixels + (top + row)*image->width;
+		for (int i = 0; i < atlas.pitch; i++) {
+			if (coverage[i] & 0x80 && left + i >= 0 && left + i < image->width) pixel[left + i] = color;
+		}
+	}
+}
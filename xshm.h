@@ -0,0 +1,20 @@
+#ifndef XSHM_H
+#define XSHM_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+bool xshm_init(
+	xcb_connection_t *, xcb_screen_t *, xcb_gcontext_t, xcb_font_t,
+	xcb_charinfo_t *metrics, int ascent, int descent
+);
+bool xshm_use(uint32_t window);
+void xshm_forget(uint32_t window);
+bool xshm_resize(int width, int height);
+void xshm_fill(int x, int y, int width, int height, uint32_t color);
+int xshm_text(const char *s, int length, int x, int y, uint32_t color);
+void xshm_shift(int dy);
+void xshm_present(int y, int height);
+
+#endif